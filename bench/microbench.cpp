@@ -0,0 +1,720 @@
+/*
+    Copyright 2022-2024 Hydr8gon
+
+    This file is part of rokuyon.
+
+    rokuyon is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    rokuyon is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with rokuyon. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../src/ai.h"
+#include "../src/core.h"
+#include "../src/cpu.h"
+#include "../src/cpu_cp0.h"
+#include "../src/cpu_cp1.h"
+#include "../src/memory.h"
+#include "../src/mi.h"
+#include "../src/pi.h"
+#include "../src/pif.h"
+#include "../src/rdp.h"
+#include "../src/rsp.h"
+#include "../src/rsp_cp0.h"
+#include "../src/rsp_cp2.h"
+#include "../src/settings.h"
+#include "../src/si.h"
+#include "../src/vi.h"
+
+// Measures isolated hot paths with synthetic inputs and reports the best time per operation in nanoseconds
+// Internal kernels are driven through the entry points the rest of the emulator uses, so they run unmodified
+// Usage: microbench [options]
+//   -f, --filter <text>    Only run benchmarks with names containing the text
+//   -t, --time <ms>        Time to spend measuring each benchmark (default 200)
+//   -o, --output <file>    Save the results, so another build can be compared against them
+//   -b, --baseline <file>  Compare the results with ones saved by -o and show the difference
+//   -l, --list             List the benchmark names without running them
+
+struct Benchmark
+{
+    std::string name;
+    void (*setup)(int param);
+    uint64_t (*run)(int param); // Runs a batch and returns the number of operations done
+    int param;
+};
+
+struct Region
+{
+    const char *name;
+    uint32_t address;
+    uint32_t mask;
+    bool writable;
+    bool io;
+};
+
+// Memory regions to access, with masks that keep accesses inside them
+static const Region regions[] =
+{
+    { "rdram", 0x80100000, 0xFFF, true,  false },
+    { "tlb",   0x10000000, 0xFFF, true,  false }, // Mapped by the last TLB entry, so every entry is checked
+    { "dmem",  0xA4000000, 0xFFF, true,  false },
+    { "rom",   0xB0000000, 0xFFF, false, false },
+    { "pif",   0xBFC007C0, 0x1F,  true,  false }, // Stays clear of the PIF command byte
+    { "mi",    0xA430000C, 0x0,   true,  true  }  // MI_MASK, which is safe to read and write with 0
+};
+
+// RSP vector instruction names, with null entries for opcodes that aren't instructions
+static const char *vecNames[0x40] =
+{
+    "vmulf", "vmulu", nullptr, nullptr, "vmudl", "vmudm", "vmudn", "vmudh", // 0x00-0x07
+    "vmacf", "vmacu", nullptr, nullptr, "vmadl", "vmadm", "vmadn", "vmadh", // 0x08-0x0F
+    "vadd",  "vsub",  nullptr, "vabs",  "vaddc", "vsubc", nullptr, nullptr, // 0x10-0x17
+    nullptr, nullptr, nullptr, nullptr, nullptr, "vsar",  nullptr, nullptr, // 0x18-0x1F
+    "vlt",   "veq",   "vne",   "vge",   "vcl",   "vch",   "vcr",   "vmrg",  // 0x20-0x27
+    "vand",  "vnand", "vor",   "vnor",  "vxor",  "vnxor", nullptr, nullptr, // 0x28-0x2F
+    "vrcp",  "vrcpl", "vrcph", "vmov",  "vrsq",  "vrsql", "vrsqh", nullptr, // 0x30-0x37
+    nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr  // 0x38-0x3F
+};
+
+// RDP texture formats that can be sampled, with their format field values
+static const struct { const char *name; int format; } texFormats[] =
+{
+    { "rgba16", 2 }, { "rgba32", 3 }, { "ci4", 8 }, { "ci8", 9 }, { "ia4", 12 },
+    { "ia8", 13 }, { "ia16", 14 }, { "i4", 16 }, { "i8", 17 }
+};
+
+// RDP blender modes, as other modes bits for the cycle type and first cycle inputs
+static const struct { const char *name; uint64_t modes; } blendModes[] =
+{
+    { "fill",         3ULL << 52 },
+    { "blend_alpha",  (1 << 22) },                           // Combined color over memory by pixel alpha
+    { "blend_fog",    (3U << 30) | (2 << 26) },               // Fog color over combined color by shade alpha
+    { "blend_opaque", (3 << 26) | (2 << 18) },                // Combined color at full weight
+    { "blend_2cycle", (1ULL << 52) | (1 << 22) | (1 << 20) }  // Alpha blending in both cycles
+};
+
+static const char *triangleNames[] =
+{
+    "flat", "z", "tex", "tex_z", "shade", "shade_z", "shade_tex", "shade_tex_z"
+};
+
+static const char *qualityNames[] = { "linear", "cubic", "sinc" };
+
+// Keeps results alive so the compiler can't remove the work that produced them
+static volatile uint64_t sink;
+static std::vector<uint8_t> romData;
+
+static void resetComponents()
+{
+    // Reset everything the benchmarks touch, the same way booting a ROM does
+    Core::resetScheduler();
+    Memory::reset();
+    AI::reset();
+    CPU::reset();
+    CPU_CP0::reset();
+    CPU_CP1::reset();
+    MI::reset();
+    PI::reset();
+    SI::reset();
+    VI::reset();
+    PIF::reset();
+    RDP::reset();
+    RSP::reset();
+    RSP_CP0::reset();
+    RSP_CP2::reset();
+    Core::resetScheduler();
+}
+
+static uint32_t nextRandom(uint32_t &seed)
+{
+    // Generate repeatable pseudo-random values, so every build is given the same input
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+static void setupMemory(int index)
+{
+    // Map a TLB page pair to RDRAM at 1MB, and fill the accessed memory with data
+    uint32_t seed = 1;
+    Memory::setEntry(31, (0x100000 >> 6), (0x101000 >> 6), 0x10000000, 0);
+    if (regions[index].writable && !regions[index].io)
+    {
+        for (uint32_t i = 0; i <= regions[index].mask; i += 4)
+            Memory::write<uint32_t>(regions[index].address + i, nextRandom(seed));
+    }
+}
+
+template <typename T> static uint64_t readMemory(int index)
+{
+    // Read values of the given size across the region
+    const Region &region = regions[index];
+    T sum = 0;
+    for (uint32_t i = 0; i < 4096; i++)
+        sum += Memory::read<T>(region.address + ((i * sizeof(T)) & region.mask));
+    sink = sink + sum;
+    return 4096;
+}
+
+template <typename T> static uint64_t writeMemory(int index)
+{
+    // Write values of the given size across the region
+    const Region &region = regions[index];
+    for (uint32_t i = 0; i < 4096; i++)
+        Memory::write<T>(region.address + ((i * sizeof(T)) & region.mask), region.io ? 0 : (T)i);
+    return 4096;
+}
+
+static uint32_t rType(uint32_t func, uint32_t rs, uint32_t rt, uint32_t rd, uint32_t sa = 0)
+{
+    // Encode a MIPS register instruction
+    return (rs << 21) | (rt << 16) | (rd << 11) | (sa << 6) | func;
+}
+
+static uint32_t iType(uint32_t op, uint32_t rs, uint32_t rt, uint16_t imm)
+{
+    // Encode a MIPS immediate instruction
+    return (op << 26) | (rs << 21) | (rt << 16) | imm;
+}
+
+static void setupCpu(int mix)
+{
+    // Build a loop of instructions for the mix, using registers t0-t4 and s0
+    std::vector<uint32_t> code;
+    switch (mix)
+    {
+        case 0: // ALU
+            for (int i = 0; i < 8; i++)
+            {
+                code.push_back(rType(0x21, 8, 9, 8)); // addu t0,t0,t1
+                code.push_back(rType(0x26, 10, 8, 10)); // xor t2,t2,t0
+                code.push_back(rType(0x00, 0, 8, 11, 3)); // sll t3,t0,3
+                code.push_back(rType(0x2A, 11, 10, 12)); // slt t4,t3,t2
+                code.push_back(iType(0x0D, 9, 9, 0x55)); // ori t1,t1,0x55
+                code.push_back(iType(0x09, 8, 8, 1)); // addiu t0,t0,1
+                code.push_back(rType(0x24, 10, 11, 12)); // and t4,t2,t3
+                code.push_back(rType(0x23, 12, 9, 11)); // subu t3,t4,t1
+            }
+            break;
+
+        case 1: // Branch
+            for (int i = 0; i < 8; i++)
+            {
+                code.push_back(iType(0x04, 0, 0, 2)); // beq zero,zero,+2 (taken)
+                code.push_back(0); // Delay slot
+                code.push_back(0); // Skipped
+                code.push_back(iType(0x05, 0, 0, 2)); // bne zero,zero,+2 (not taken)
+                code.push_back(0); // Delay slot
+                code.push_back(iType(0x09, 8, 8, 1)); // addiu t0,t0,1
+            }
+            break;
+
+        case 2: // Load/store
+            code.push_back(iType(0x0F, 0, 16, 0x8020)); // lui s0,0x8020
+            for (int i = 0; i < 8; i++)
+            {
+                code.push_back(iType(0x23, 16, 8, i * 32 + 0)); // lw t0,0(s0)
+                code.push_back(iType(0x2B, 16, 8, i * 32 + 4)); // sw t0,4(s0)
+                code.push_back(iType(0x24, 16, 9, i * 32 + 8)); // lbu t1,8(s0)
+                code.push_back(iType(0x29, 16, 9, i * 32 + 12)); // sh t1,12(s0)
+                code.push_back(iType(0x37, 16, 10, i * 32 + 16)); // ld t2,16(s0)
+                code.push_back(iType(0x3F, 16, 10, i * 32 + 24)); // sd t2,24(s0)
+            }
+            break;
+    }
+
+    // Jump back to the start, and write the loop to RDRAM
+    code.push_back((0x02 << 26) | ((0x80010000 >> 2) & 0x3FFFFFF)); // j start
+    code.push_back(0); // Delay slot
+    for (size_t i = 0; i < code.size(); i++)
+        Memory::write<uint32_t>(0x80010000 + i * 4, code[i]);
+
+    // Point the CPU at the loop, with the pipeline empty
+    CPU::reset();
+    CPU::programCounter = 0x80010000 - 4;
+}
+
+static uint64_t runCpu(int)
+{
+    // Run the loop through the interpreter
+    for (int i = 0; i < 4096; i++)
+        CPU::runOpcode();
+    return 4096;
+}
+
+static void setupVector(int)
+{
+    // Fill the vector registers with repeatable data
+    uint32_t seed = 1;
+    RSP_CP2::reset();
+    for (int i = 0; i < 32; i++)
+    {
+        for (int j = 0; j < 8; j++)
+            RSP_CP2::write(false, i, j * 2, nextRandom(seed));
+    }
+}
+
+static uint64_t runVector(int op)
+{
+    // Run the instruction with vd = v3, vs = v1, vt = v2, cycling through element modifiers
+    for (int i = 0; i < 4096; i++)
+        (*RSP_CP2::vecInstrs[op])((0x25 << 25) | ((i & 0xF) << 21) | (2 << 16) | (1 << 11) | (3 << 6) | op);
+    return 4096;
+}
+
+static void runRdp(const std::vector<uint64_t> &params)
+{
+    // Run RDP commands as if they were read from memory
+    RDP::replayParams(params.data(), params.size());
+}
+
+static uint64_t rdpPixels()
+{
+    // Get the total number of pixels the RDP has processed
+    CoreStats stats = {};
+    RDP::getStats(stats);
+    return stats.rdpPixels;
+}
+
+static uint64_t packInt(int32_t a, int32_t b, int32_t c, int32_t d)
+{
+    // Pack the integer halves of 4 triangle coefficients into a parameter
+    return ((uint64_t)(uint16_t)(a >> 16) << 48) | ((uint64_t)(uint16_t)(b >> 16) << 32) |
+        ((uint64_t)(uint16_t)(c >> 16) << 16) | (uint16_t)(d >> 16);
+}
+
+static uint64_t packFrac(int32_t a, int32_t b, int32_t c, int32_t d)
+{
+    // Pack the fractional halves of 4 triangle coefficients into a parameter
+    return ((uint64_t)(uint16_t)a << 48) | ((uint64_t)(uint16_t)b << 32) | ((uint64_t)(uint16_t)c << 16) | (uint16_t)d;
+}
+
+static void setupRdp(uint64_t modes, int format)
+{
+    // Draw to a 320x240 RGBA16 color buffer, with a Z buffer that every test passes against
+    RDP::reset();
+    memset(&Memory::rdram[0x200000], 0xFF, 320 * 240 * 2);
+    std::vector<uint64_t> params =
+    {
+        0x3F10013F00100000, // Set Color Image
+        0x3E00000000200000, // Set Z Image
+        0x2D000000005003C0, // Set Scissor
+        0x2F00000000000000 | modes, // Set Other Modes
+        0x3700000012345678, // Set Fill Color
+        0x3800000040404080, // Set Fog Color
+        0x3900000080808080, // Set Blend Color
+        0x3A000000C0A08060, // Set Prim Color
+        0x3B000000306090C0, // Set Env Color
+        0x3500000000000000 | ((uint64_t)format << 51) | (8ULL << 41) | (5 << 14) | (5 << 4) // Set Tile
+    };
+    runRdp(params);
+}
+
+static void setupTexel(int index)
+{
+    // Copy texels directly to the color buffer, so sampling is most of the work
+    setupRdp(2ULL << 52, texFormats[index].format);
+}
+
+static uint64_t runTexel(int)
+{
+    // Draw 64x64 texture rectangles, stepping 1 texel per pixel
+    uint64_t start = rdpPixels();
+    std::vector<uint64_t> params;
+    for (int i = 0; i < 4; i++)
+    {
+        params.push_back((0x24ULL << 56) | (252ULL << 44) | (252ULL << 32));
+        params.push_back((0x1000 << 16) | 0x400);
+    }
+    runRdp(params);
+    return rdpPixels() - start;
+}
+
+static void setupFiltered(int index)
+{
+    // Sample with texture filtering in 1-cycle mode
+    Settings::texFilter = 1;
+    setupRdp(1ULL << 45, texFormats[index].format);
+}
+
+static uint64_t runFiltered(int)
+{
+    // Draw 64x64 texture rectangles, stepping 1 texel per pixel
+    uint64_t start = rdpPixels();
+    std::vector<uint64_t> params;
+    for (int i = 0; i < 4; i++)
+    {
+        params.push_back((0x24ULL << 56) | (256ULL << 44) | (256ULL << 32));
+        params.push_back((0x400 << 16) | 0x400);
+    }
+    runRdp(params);
+    return rdpPixels() - start;
+}
+
+static void setupTriangle(int)
+{
+    // Draw in 1-cycle mode with depth testing
+    setupRdp(1 << 4, 2);
+}
+
+static uint64_t runTriangle(int op)
+{
+    // Build a right triangle 64 pixels tall, widening by 1 pixel per line
+    std::vector<uint64_t> params;
+    params.push_back(((uint64_t)op << 56) | (1ULL << 55) | (288ULL << 32) | (288 << 16) | 32);
+    params.push_back((uint64_t)(8 << 16) << 32); // Low edge
+    params.push_back((uint64_t)(8 << 16) << 32); // High edge
+    params.push_back(((uint64_t)(8 << 16) << 32) | 0x10000); // Middle edge
+
+    if (op & 0x4)
+    {
+        // Add shade coefficients, with a red gradient across each line
+        int32_t color = 0x80 << 16, dx = 1 << 16;
+        params.push_back(packInt(color, color, color, color));
+        params.push_back(packInt(dx, 0, 0, 0));
+        params.push_back(packFrac(color, color, color, color));
+        params.push_back(packFrac(dx, 0, 0, 0));
+        params.push_back(0);
+        params.push_back(0);
+        params.push_back(0);
+        params.push_back(0);
+    }
+
+    if (op & 0x2)
+    {
+        // Add texture coefficients that step 1 texel per pixel at a constant W
+        int32_t w = 0x7FFF0000, step = 0x20 * 0xFFFE;
+        params.push_back(packInt(0, 0, w, 0));
+        params.push_back(packInt(step, 0, 0, 0));
+        params.push_back(packFrac(0, 0, w, 0));
+        params.push_back(packFrac(step, 0, 0, 0));
+        params.push_back(packInt(0, step, 0, 0));
+        params.push_back(0);
+        params.push_back(packFrac(0, step, 0, 0));
+        params.push_back(0);
+    }
+
+    if (op & 0x1)
+    {
+        // Add depth coefficients for a flat Z that's in front of the buffer
+        params.push_back(0x1000ULL << 48);
+        params.push_back(0);
+    }
+
+    // Draw the triangle a few times
+    uint64_t start = rdpPixels();
+    std::vector<uint64_t> batch;
+    for (int i = 0; i < 4; i++)
+        batch.insert(batch.end(), params.begin(), params.end());
+    runRdp(batch);
+    return rdpPixels() - start;
+}
+
+static void setupBlend(int index)
+{
+    // Draw with the blender mode
+    setupRdp(blendModes[index].modes, 2);
+}
+
+static uint64_t runBlend(int index)
+{
+    // Draw 64x64 fill rectangles, which go through the combiner and blender outside of fill mode
+    uint64_t start = rdpPixels();
+    std::vector<uint64_t> params;
+    uint64_t x2 = (index == 0) ? 252 : 256;
+    for (int i = 0; i < 4; i++)
+        params.push_back((0x36ULL << 56) | (x2 << 44) | (x2 << 32));
+    runRdp(params);
+    return rdpPixels() - start;
+}
+
+static void setupVi(int mode)
+{
+    // Set up a 320x240 or 640x480 framebuffer in RGBA16 or RGBA32
+    uint32_t seed = 1;
+    uint32_t width = (mode == 2) ? 640 : 320;
+    VI::reset();
+    Core::resetScheduler();
+    for (uint32_t i = 0; i < 640 * 480 * 4; i += 4)
+        Memory::write<uint32_t>(0x80100000 + i, nextRandom(seed));
+    VI::write(0x4400000, (mode == 1) ? 0x3 : 0x2); // VI_CONTROL
+    VI::write(0x4400004, 0x100000); // VI_ORIGIN
+    VI::write(0x4400008, width); // VI_WIDTH
+    VI::write(0x4400024, 640); // VI_H_VIDEO
+    VI::write(0x4400028, 480); // VI_V_VIDEO
+    VI::write(0x4400030, width * 0x200 / 320); // VI_X_SCALE
+    VI::write(0x4400034, width * 0x400 / 320); // VI_Y_SCALE
+}
+
+static uint64_t runVi(int)
+{
+    // Convert a frame and take it off the queue, without letting the scheduler grow
+    VI::drawFrame();
+    _Framebuffer *fb = VI::getFramebuffer();
+    uint64_t pixels = fb ? (fb->width * fb->height) : 0;
+    delete fb;
+    Core::resetScheduler();
+    return pixels;
+}
+
+static void setupAudio(int quality)
+{
+    // Set up 32kHz samples of a repeatable waveform, released as soon as they're resampled
+    uint32_t seed = 1;
+    Settings::audioQuality = quality;
+    AI::reset();
+    Core::resetScheduler();
+    for (uint32_t i = 0; i < 0x4000; i += 4)
+        Memory::write<uint32_t>(0x80300000 + i, nextRandom(seed) & 0x0FFF0FFF);
+    AI::write(0x4500008, 1); // AI_CONTROL
+    AI::write(0x4500010, 48681812 / 32000); // AI_DAC_RATE
+}
+
+static uint64_t runAudio(int)
+{
+    // Submit 4096 samples and finish them right away, so the next submission starts a new buffer
+    static uint32_t out[0x2000];
+    AI::write(0x4500000, 0x300000); // AI_DRAM_ADDR
+    AI::write(0x4500004, 0x4000); // AI_LENGTH
+    AI::processBuffer();
+    while (AI::drainBuffer(out, 0x2000));
+    Core::resetScheduler();
+    return 0x4000 / 4;
+}
+
+static void setupSchedule(int)
+{
+    // Start with an empty queue
+    Core::resetScheduler();
+}
+
+static uint64_t runSchedule(int)
+{
+    // Fill a queue about as deep as a running game's, then start over
+    static uint32_t seed = 1;
+    for (int i = 0; i < 256; i++)
+    {
+        Core::resetScheduler();
+        for (int j = 0; j < 8; j++)
+            Core::schedule((TaskType)(1 + (j & 7)), nextRandom(seed) & 0xFFFFF);
+    }
+    return 256 * 8;
+}
+
+static std::vector<Benchmark> listBenchmarks()
+{
+    std::vector<Benchmark> benches;
+    static const char *sizes[] = { "u8", "u16", "u32", "u64" };
+    static uint64_t (*reads[])(int) = { readMemory<uint8_t>, readMemory<uint16_t>, readMemory<uint32_t>, readMemory<uint64_t> };
+    static uint64_t (*writes[])(int) = { writeMemory<uint8_t>, writeMemory<uint16_t>, writeMemory<uint32_t>, writeMemory<uint64_t> };
+
+    // Add memory accesses for each region and size, with I/O registers only taking 32-bit accesses
+    for (int i = 0; i < (int)(sizeof(regions) / sizeof(Region)); i++)
+    {
+        for (int j = 0; j < 4; j++)
+        {
+            if (regions[i].io && j != 2) continue;
+            benches.push_back({ std::string("mem_read_") + sizes[j] + "_" + regions[i].name, setupMemory, reads[j], i });
+            if (regions[i].writable)
+                benches.push_back({ std::string("mem_write_") + sizes[j] + "_" + regions[i].name, setupMemory, writes[j], i });
+        }
+    }
+
+    // Add CPU instruction mixes
+    benches.push_back({ "cpu_alu", setupCpu, runCpu, 0 });
+    benches.push_back({ "cpu_branch", setupCpu, runCpu, 1 });
+    benches.push_back({ "cpu_load_store", setupCpu, runCpu, 2 });
+
+    // Add each RSP vector instruction
+    for (int i = 0; i < 0x40; i++)
+    {
+        if (vecNames[i])
+            benches.push_back({ std::string("rsp_") + vecNames[i], setupVector, runVector, i });
+    }
+
+    // Add RDP texture sampling for each format, triangle specialisations, and blender modes
+    for (int i = 0; i < (int)(sizeof(texFormats) / sizeof(texFormats[0])); i++)
+        benches.push_back({ std::string("rdp_texel_") + texFormats[i].name, setupTexel, runTexel, i });
+    benches.push_back({ "rdp_texel_rgba16_filtered", setupFiltered, runFiltered, 0 });
+    for (int i = 0; i < 8; i++)
+        benches.push_back({ std::string("rdp_triangle_") + triangleNames[i], setupTriangle, runTriangle, 0x08 + i });
+    for (int i = 0; i < (int)(sizeof(blendModes) / sizeof(blendModes[0])); i++)
+        benches.push_back({ std::string("rdp_") + blendModes[i].name, setupBlend, runBlend, i });
+
+    // Add VI conversion, AI resampling, and scheduling
+    benches.push_back({ "vi_rgba16_320x240", setupVi, runVi, 0 });
+    benches.push_back({ "vi_rgba32_320x240", setupVi, runVi, 1 });
+    benches.push_back({ "vi_rgba16_640x480", setupVi, runVi, 2 });
+    for (int i = 0; i < 3; i++)
+        benches.push_back({ std::string("ai_resample_") + qualityNames[i], setupAudio, runAudio, i });
+    benches.push_back({ "core_schedule", setupSchedule, runSchedule, 0 });
+    return benches;
+}
+
+static double measure(const Benchmark &bench, uint64_t budget)
+{
+    // Prepare the benchmark and run a batch to warm up caches and branch predictors
+    bench.setup(bench.param);
+    bench.run(bench.param);
+
+    // Run batches until the time is used up, keeping the fastest so noise from the host is filtered out
+    double best = 0;
+    uint64_t start = Core::hostTime();
+    do
+    {
+        uint64_t batchStart = Core::hostTime();
+        uint64_t ops = bench.run(bench.param);
+        uint64_t time = Core::hostTime() - batchStart;
+        double ns = ops ? double(time) / ops : 0;
+        if (ops && (best == 0 || ns < best))
+            best = ns;
+    }
+    while (Core::hostTime() - start < budget);
+    return best;
+}
+
+static bool loadResults(const char *path, std::map<std::string, double> &results)
+{
+    // Read results saved by a previous run, with lines of "<name> <ns/op>"
+    FILE *file = fopen(path, "r");
+    if (!file) return false;
+    char name[256];
+    double ns;
+    while (fscanf(file, "%255s %lf", name, &ns) == 2)
+        results[name] = ns;
+    fclose(file);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    const char *filter = "";
+    const char *outputPath = nullptr;
+    const char *baselinePath = nullptr;
+    uint64_t budget = 200;
+    bool list = false;
+    bool valid = true;
+
+    // Parse the command line
+    for (int i = 1; i < argc; i++)
+    {
+        if ((!strcmp(argv[i], "-f") || !strcmp(argv[i], "--filter")) && i + 1 < argc)
+            filter = argv[++i];
+        else if ((!strcmp(argv[i], "-t") || !strcmp(argv[i], "--time")) && i + 1 < argc)
+            budget = strtoull(argv[++i], nullptr, 10);
+        else if ((!strcmp(argv[i], "-o") || !strcmp(argv[i], "--output")) && i + 1 < argc)
+            outputPath = argv[++i];
+        else if ((!strcmp(argv[i], "-b") || !strcmp(argv[i], "--baseline")) && i + 1 < argc)
+            baselinePath = argv[++i];
+        else if (!strcmp(argv[i], "-l") || !strcmp(argv[i], "--list"))
+            list = true;
+        else
+            valid = false;
+    }
+
+    if (!valid || budget == 0)
+    {
+        fprintf(stderr, "Usage: %s [-f filter] [-t ms] [-o output] [-b baseline] [-l]\n", argv[0]);
+        return 1;
+    }
+
+    // Load the results to compare against
+    std::map<std::string, double> baseline;
+    if (baselinePath && !loadResults(baselinePath, baseline))
+    {
+        fprintf(stderr, "Failed to open baseline: %s\n", baselinePath);
+        return 1;
+    }
+
+    // Select the benchmarks to run
+    std::vector<Benchmark> benches;
+    for (const Benchmark &bench : listBenchmarks())
+    {
+        if (bench.name.find(filter) != std::string::npos)
+            benches.push_back(bench);
+    }
+
+    if (list)
+    {
+        for (size_t i = 0; i < benches.size(); i++)
+            printf("%s\n", benches[i].name.c_str());
+        return 0;
+    }
+
+    // Keep everything on this thread and avoid pacing, skipping, or dropping any work
+    Settings::threadedRdp = 0;
+    Settings::fpsLimiter = 0;
+    Settings::dynamicRate = 1;
+    Settings::frameskip = 0;
+    Settings::texFilter = 0;
+    Settings::perfStats = 0;
+    Settings::trace = 0;
+    Settings::profiler = 0;
+
+    // Insert a synthetic 1MB ROM, with a big-endian header so it can be used in place
+    romData.resize(0x100000);
+    uint32_t seed = 1;
+    for (size_t i = 0; i < romData.size(); i++)
+        romData[i] = nextRandom(seed);
+    romData[0] = 0x80;
+    romData[1] = 0x37;
+    romData[2] = 0x12;
+    romData[3] = 0x40;
+    Core::loadRom(romData.data(), romData.size(), true);
+    resetComponents();
+
+    // Run the benchmarks and print the results
+    FILE *output = nullptr;
+    if (outputPath && !(output = fopen(outputPath, "w")))
+    {
+        fprintf(stderr, "Failed to open output: %s\n", outputPath);
+        return 1;
+    }
+
+    printf("%-32s %10s", "benchmark", "ns/op");
+    if (!baseline.empty())
+        printf(" %10s %8s", "baseline", "change");
+    printf("\n");
+
+    for (size_t i = 0; i < benches.size(); i++)
+    {
+        double ns = measure(benches[i], budget * 1000000);
+        printf("%-32s %10.3f", benches[i].name.c_str(), ns);
+        if (!baseline.empty())
+        {
+            // Show the difference from the baseline, where negative is faster
+            std::map<std::string, double>::iterator it = baseline.find(benches[i].name);
+            if (it != baseline.end() && it->second > 0)
+                printf(" %10.3f %+7.1f%%", it->second, (ns - it->second) * 100 / it->second);
+            else
+                printf(" %10s %8s", "-", "-");
+        }
+        printf("\n");
+        fflush(stdout);
+
+        if (output)
+            fprintf(output, "%s %.4f\n", benches[i].name.c_str(), ns);
+
+        // Start the next benchmark from a clean machine
+        resetComponents();
+        Settings::texFilter = 0;
+    }
+
+    if (output)
+        fclose(output);
+    return 0;
+}
@@ -0,0 +1,122 @@
+/*
+    Copyright 2022-2024 Hydr8gon
+
+    This file is part of rokuyon.
+
+    rokuyon is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    rokuyon is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with rokuyon. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../src/rdp_capture.h"
+#include "../src/settings.h"
+#include "script.h"
+
+// Replays an RDP capture from rokuyon-bench --capture-rdp as fast as possible, without a ROM
+// RDRAM is hashed at the end of each frame and compared with the capture, so rasterizer changes can be checked
+// Usage: rdp-replay [options] <capture>
+//   -l, --loops <n>      Number of times to replay the capture (default 1)
+//   --threaded-rdp       Run the RDP on its own thread
+//   --hashes             Also list the RDRAM hash of each frame from the first loop
+// Exits with 2 if any frame differs from the capture
+
+int main(int argc, char **argv)
+{
+    const char *capturePath = nullptr;
+    uint32_t loops = 1;
+    bool listHashes = false;
+    bool valid = true;
+
+    // Parse the command line
+    Settings::threadedRdp = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if ((!strcmp(argv[i], "-l") || !strcmp(argv[i], "--loops")) && i + 1 < argc)
+            loops = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--threaded-rdp"))
+            Settings::threadedRdp = 1;
+        else if (!strcmp(argv[i], "--hashes"))
+            listHashes = true;
+        else if (argv[i][0] != '-' && !capturePath)
+            capturePath = argv[i];
+        else
+            valid = false;
+    }
+
+    if (!valid || !capturePath || loops == 0)
+    {
+        fprintf(stderr, "Usage: %s [-l loops] [--threaded-rdp] [--hashes] <capture>\n", argv[0]);
+        return 1;
+    }
+
+    // Load the whole capture into memory so reading it isn't part of the measurement
+    FILE *file = fopen(capturePath, "rb");
+    if (!file)
+    {
+        fprintf(stderr, "Failed to open RDP capture: %s\n", capturePath);
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    std::vector<uint8_t> data(ftell(file));
+    fseek(file, 0, SEEK_SET);
+    size_t read = fread(data.data(), sizeof(uint8_t), data.size(), file);
+    fclose(file);
+
+    // Replay the capture, keeping the worst result across loops
+    ReplayStats stats = {};
+    uint64_t rdpTime = 0;
+    uint32_t mismatches = 0;
+    std::vector<uint64_t> hashes;
+    for (uint32_t i = 0; i < loops; i++)
+    {
+        if (read != data.size() || !RDP_Capture::replay(data, stats, i ? nullptr : &hashes))
+        {
+            fprintf(stderr, "Failed to replay RDP capture: %s\n", capturePath);
+            return 1;
+        }
+        rdpTime += stats.rdpTime;
+        mismatches = std::max(mismatches, stats.mismatches);
+    }
+
+    // Report the results
+    double seconds = rdpTime / 1000000000.0;
+    uint64_t frames = (uint64_t)stats.frames * loops;
+    printf("{\n");
+    printf("  \"capture\": \"%s\",\n", escapeJson(capturePath).c_str());
+    printf("  \"frames\": %u,\n", stats.frames);
+    printf("  \"loops\": %u,\n", loops);
+    printf("  \"rdp_seconds\": %.3f,\n", seconds);
+    printf("  \"fps\": %.2f,\n", seconds > 0 ? frames / seconds : 0.0);
+    printf("  \"per_frame\": {\n");
+    printf("    \"rdp_ms\": %.3f,\n", frames ? rdpTime / 1000000.0 / frames : 0.0);
+    printf("    \"params\": %.1f,\n", stats.frames ? double(stats.params) / stats.frames : 0.0);
+    printf("    \"page_bytes\": %.1f\n", stats.frames ? double(stats.pageBytes) / stats.frames : 0.0);
+    printf("  },\n");
+    printf("  \"mismatched_frames\": %u", mismatches);
+    if (listHashes)
+    {
+        // List the hashes so separate captures or builds can be compared
+        printf(",\n  \"hashes\": [");
+        for (size_t i = 0; i < hashes.size(); i++)
+            printf("%s\"%016llX\"", i ? ", " : "", (unsigned long long)hashes[i]);
+        printf("]");
+    }
+    printf("\n}\n");
+    return mismatches ? 2 : 0;
+}
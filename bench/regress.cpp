@@ -0,0 +1,519 @@
+/*
+    Copyright 2022-2024 Hydr8gon
+
+    This file is part of rokuyon.
+
+    rokuyon is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    rokuyon is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with rokuyon. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef WINDOWS
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "../src/ai.h"
+#include "../src/core.h"
+#include "../src/movie.h"
+#include "../src/settings.h"
+#include "../src/vi.h"
+#include "script.h"
+
+// Runs a list of ROMs headless in parallel, hashing VI output at checkpoints to catch correctness and speed regressions
+// Each ROM runs in its own process, since emulator state is global to a process
+// Usage: regress [options] <manifest>
+//   -g, --golden <file>    Golden hashes and frame time budgets to compare with (default regress.golden)
+//   -u, --update           Write the results to the golden file instead of comparing with it
+//   -f, --frames <n>       Number of frames to run each ROM for (default 600)
+//   -c, --checkpoint <n>   Number of frames between framebuffer hashes (default 60)
+//   -j, --jobs <n>         Number of ROMs to run at once (default is the number of host threads)
+//   -t, --tolerance <pct>  How far the mean frame time can exceed its budget (default 25)
+// The manifest has lines of "<rom> [input script]", where a script ending in .movie is played as an input movie, and the golden file has lines of "<test> budget <ms>" and
+// "<test> <frame> <hash>", where tests are named "<rom>" or "<rom>+<script>"
+// Paths can't contain spaces, golden hashes only apply to runs with the same -f and -c, and budgets to the same host and -j
+// Exits with 2 if any ROM fails
+
+enum TestStatus
+{
+    TEST_OK = 0,
+    TEST_NO_ROM,
+    TEST_NO_SCRIPT,
+    TEST_CRASHED
+};
+
+struct Test
+{
+    std::string name;
+    std::string rom;
+    std::string script;
+};
+
+struct Checkpoint
+{
+    uint32_t frame;
+    uint64_t hash;
+};
+
+struct ResultHeader
+{
+    uint32_t status;
+    uint32_t checkpoints;
+    double meanMs;
+    double maxMs;
+};
+
+struct TestResult
+{
+    ResultHeader header;
+    std::vector<Checkpoint> checkpoints;
+};
+
+struct Golden
+{
+    double budget;
+    std::map<uint32_t, uint64_t> hashes;
+};
+
+static const char *errorNames[] =
+{
+    "", "failed to load ROM", "failed to load input script", "crashed"
+};
+
+static bool loadManifest(const char *path, std::vector<Test> &tests)
+{
+    FILE *file = fopen(path, "r");
+    if (!file) return false;
+
+    char line[2048];
+    while (fgets(line, sizeof(line), file))
+    {
+        // Skip empty lines and comments
+        char *start = line + strspn(line, " \t");
+        if (*start == '#' || *start == '\n' || *start == '\0')
+            continue;
+
+        // Parse a ROM and an optional input script
+        char rom[1024], script[1024];
+        int count = sscanf(start, "%1023s %1023s", rom, script);
+        Test test;
+        test.rom = rom;
+        test.script = (count == 2) ? script : "";
+        test.name = (count == 2) ? (test.rom + "+" + test.script) : test.rom;
+        tests.push_back(test);
+    }
+
+    fclose(file);
+    return true;
+}
+
+static bool loadGolden(const char *path, std::map<std::string, Golden> &golden)
+{
+    FILE *file = fopen(path, "r");
+    if (!file) return false;
+
+    char line[2048];
+    while (fgets(line, sizeof(line), file))
+    {
+        // Parse a frame time budget or a checkpoint hash
+        char name[2048], field[32], value[32];
+        if (sscanf(line, "%2047s %31s %31s", name, field, value) != 3)
+            continue;
+        if (!strcmp(field, "budget"))
+            golden[name].budget = atof(value);
+        else
+            golden[name].hashes[strtoul(field, nullptr, 10)] = strtoull(value, nullptr, 16);
+    }
+
+    fclose(file);
+    return true;
+}
+
+static bool saveGolden(const char *path, const std::vector<Test> &tests, const std::vector<TestResult> &results)
+{
+    FILE *file = fopen(path, "w");
+    if (!file) return false;
+
+    // Write the budget and hashes of each ROM that ran, using the measured mean frame time as the budget
+    for (size_t i = 0; i < tests.size(); i++)
+    {
+        if (results[i].header.status != TEST_OK) continue;
+        fprintf(file, "%s budget %.3f\n", tests[i].name.c_str(), results[i].header.meanMs);
+        for (size_t j = 0; j < results[i].checkpoints.size(); j++)
+            fprintf(file, "%s %u %016llX\n", tests[i].name.c_str(), results[i].checkpoints[j].frame,
+                (unsigned long long)results[i].checkpoints[j].hash);
+    }
+
+    fclose(file);
+    return true;
+}
+
+static uint64_t hashFramebuffer(const _Framebuffer *fb)
+{
+    // Identify a frame with an FNV-1a hash of its size and pixels, or 0 if nothing was output
+    if (!fb) return 0;
+    uint64_t hash = 0xCBF29CE484222325;
+    hash = (hash ^ fb->width) * 0x100000001B3;
+    hash = (hash ^ fb->height) * 0x100000001B3;
+    for (uint32_t i = 0; i < fb->width * fb->height; i++)
+        hash = (hash ^ fb->data[i]) * 0x100000001B3;
+    return hash;
+}
+
+static void runTest(const Test &test, uint32_t frames, uint32_t interval, TestResult &result)
+{
+    // Load the input script or movie if there is one, and boot the ROM without ever writing the save file
+    memset(&result.header, 0, sizeof(result.header));
+    std::vector<InputEvent> events;
+    size_t ext = test.script.rfind(".movie");
+    bool movie = (ext != std::string::npos && ext + 6 == test.script.size());
+    if (!test.script.empty() && !(movie ? Movie::play(test.script) : loadScript(test.script.c_str(), events)))
+    {
+        result.header.status = TEST_NO_SCRIPT;
+        return;
+    }
+
+    if (!Core::bootRom(test.rom))
+    {
+        result.header.status = TEST_NO_ROM;
+        return;
+    }
+    Core::savePath = "";
+
+    static uint32_t samples[0x2000];
+    size_t next = 0;
+    double total = 0;
+
+    for (uint32_t i = 0; i < frames; i++)
+    {
+        // Run a frame with scripted input and consume its output like a frontend would
+        applyScript(events, next, i);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        Core::runFrame();
+        _Framebuffer *fb = VI::getFramebuffer();
+        AI::drainBuffer(samples, sizeof(samples) / sizeof(*samples));
+        double time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        total += time;
+        result.header.maxMs = std::max(result.header.maxMs, time);
+
+        // Hash the frame's output at each checkpoint
+        if ((i + 1) % interval == 0)
+        {
+            Checkpoint checkpoint = { i + 1, hashFramebuffer(fb) };
+            result.checkpoints.push_back(checkpoint);
+        }
+        delete fb;
+    }
+
+    Core::stop();
+    Movie::stop();
+    result.header.meanMs = total / frames;
+    result.header.checkpoints = result.checkpoints.size();
+}
+
+#ifndef WINDOWS
+struct Job
+{
+    pid_t pid;
+    int fd;
+    size_t index;
+    std::vector<uint8_t> data;
+};
+
+static bool writeAll(int fd, const void *data, size_t size)
+{
+    // Write all of the data to a pipe, even if it takes multiple calls
+    const uint8_t *bytes = (const uint8_t*)data;
+    while (size > 0)
+    {
+        ssize_t count = write(fd, bytes, size);
+        if (count <= 0) return false;
+        bytes += count;
+        size -= count;
+    }
+    return true;
+}
+
+static bool startJob(const Test &test, size_t index, uint32_t frames, uint32_t interval, Job &job)
+{
+    // Create a pipe for the child to send its result through
+    int fds[2];
+    if (pipe(fds)) return false;
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        // Run the test in the child and send the result back
+        close(fds[0]);
+        TestResult result;
+        runTest(test, frames, interval, result);
+        bool sent = writeAll(fds[1], &result.header, sizeof(result.header)) &&
+            writeAll(fds[1], result.checkpoints.data(), result.checkpoints.size() * sizeof(Checkpoint));
+        _exit(sent ? 0 : 1);
+    }
+
+    close(fds[1]);
+    if (pid < 0)
+    {
+        close(fds[0]);
+        return false;
+    }
+
+    job.pid = pid;
+    job.fd = fds[0];
+    job.index = index;
+    job.data.clear();
+    return true;
+}
+
+static void finishJob(Job &job, TestResult &result)
+{
+    // Wait for the child to exit, and decode its result if it sent a complete one
+    int status;
+    close(job.fd);
+    bool exited = (waitpid(job.pid, &status, 0) == job.pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    memset(&result.header, 0, sizeof(result.header));
+    result.header.status = TEST_CRASHED;
+
+    if (exited && job.data.size() >= sizeof(ResultHeader))
+    {
+        ResultHeader header;
+        memcpy(&header, job.data.data(), sizeof(header));
+        if (job.data.size() == sizeof(header) + header.checkpoints * sizeof(Checkpoint))
+        {
+            result.header = header;
+            result.checkpoints.resize(header.checkpoints);
+            memcpy(result.checkpoints.data(), &job.data[sizeof(header)], header.checkpoints * sizeof(Checkpoint));
+        }
+    }
+}
+
+static void runJobs(const std::vector<Test> &tests, uint32_t frames, uint32_t interval,
+    uint32_t jobs, std::vector<TestResult> &results)
+{
+    std::vector<Job> running;
+    size_t next = 0, done = 0;
+
+    while (next < tests.size() || !running.empty())
+    {
+        // Start tests until the job limit is reached
+        while (next < tests.size() && running.size() < jobs)
+        {
+            Job job;
+            if (startJob(tests[next], next, frames, interval, job))
+            {
+                running.push_back(job);
+            }
+            else
+            {
+                results[next].header.status = TEST_CRASHED;
+                fprintf(stderr, "[%u/%u] %s: failed to start\n", (uint32_t)++done, (uint32_t)tests.size(), tests[next].name.c_str());
+            }
+            next++;
+        }
+        if (running.empty()) continue;
+
+        // Wait for results from the running tests, reading them as they arrive so no pipe fills up
+        std::vector<pollfd> fds(running.size());
+        for (size_t i = 0; i < running.size(); i++)
+        {
+            fds[i].fd = running[i].fd;
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0)
+            continue;
+
+        for (size_t i = running.size(); i-- > 0;)
+        {
+            if (!fds[i].revents) continue;
+            uint8_t buffer[4096];
+            ssize_t count = read(running[i].fd, buffer, sizeof(buffer));
+            if (count > 0)
+            {
+                running[i].data.insert(running[i].data.end(), buffer, buffer + count);
+                continue;
+            }
+
+            // Finish a test once its child closes the pipe
+            TestResult &result = results[running[i].index];
+            finishJob(running[i], result);
+            fprintf(stderr, "[%u/%u] %s: %s\n", (uint32_t)++done, (uint32_t)tests.size(),
+                tests[running[i].index].name.c_str(), result.header.status ? errorNames[result.header.status] : "done");
+            running.erase(running.begin() + i);
+        }
+    }
+}
+#endif
+
+int main(int argc, char **argv)
+{
+    const char *manifestPath = nullptr;
+    const char *goldenPath = "regress.golden";
+    uint32_t frames = 600;
+    uint32_t interval = 60;
+    uint32_t jobs = std::max(1U, std::thread::hardware_concurrency());
+    double tolerance = 25;
+    bool update = false;
+    bool valid = true;
+
+    // Use a fixed configuration so results are repeatable, and run uncapped
+    Settings::fpsLimiter = 0;
+    Settings::expansionPak = 0;
+    Settings::threadedRdp = 0;
+    Settings::frameskip = 0;
+    Settings::mmapSaves = 0;
+
+    // Parse the command line
+    for (int i = 1; i < argc; i++)
+    {
+        if ((!strcmp(argv[i], "-g") || !strcmp(argv[i], "--golden")) && i + 1 < argc)
+            goldenPath = argv[++i];
+        else if (!strcmp(argv[i], "-u") || !strcmp(argv[i], "--update"))
+            update = true;
+        else if ((!strcmp(argv[i], "-f") || !strcmp(argv[i], "--frames")) && i + 1 < argc)
+            frames = atoi(argv[++i]);
+        else if ((!strcmp(argv[i], "-c") || !strcmp(argv[i], "--checkpoint")) && i + 1 < argc)
+            interval = atoi(argv[++i]);
+        else if ((!strcmp(argv[i], "-j") || !strcmp(argv[i], "--jobs")) && i + 1 < argc)
+            jobs = atoi(argv[++i]);
+        else if ((!strcmp(argv[i], "-t") || !strcmp(argv[i], "--tolerance")) && i + 1 < argc)
+            tolerance = atof(argv[++i]);
+        else if (argv[i][0] != '-' && !manifestPath)
+            manifestPath = argv[i];
+        else
+            valid = false;
+    }
+
+    if (!valid || !manifestPath || frames == 0 || interval == 0 || jobs == 0)
+    {
+        fprintf(stderr, "Usage: %s [-g golden] [-u] [-f frames] [-c checkpoint] [-j jobs] [-t tolerance] <manifest>\n", argv[0]);
+        return 1;
+    }
+
+    // Load the ROMs to run, and the results to compare with
+    std::vector<Test> tests;
+    if (!loadManifest(manifestPath, tests) || tests.empty())
+    {
+        fprintf(stderr, "Failed to load a manifest with ROMs: %s\n", manifestPath);
+        return 1;
+    }
+
+    std::map<std::string, Golden> golden;
+    if (!update && !loadGolden(goldenPath, golden))
+    {
+        fprintf(stderr, "Failed to load golden results: %s\n", goldenPath);
+        return 1;
+    }
+
+    // Run the tests, in parallel processes when possible
+    std::vector<TestResult> results(tests.size());
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+#ifndef WINDOWS
+    runJobs(tests, frames, interval, jobs, results);
+#else
+    for (size_t i = 0; i < tests.size(); i++)
+        runTest(tests[i], frames, interval, results[i]);
+#endif
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+    if (update && !saveGolden(goldenPath, tests, results))
+    {
+        fprintf(stderr, "Failed to write golden results: %s\n", goldenPath);
+        return 1;
+    }
+
+    // Report the results, comparing them with the golden ones unless they were just written
+    uint32_t failed = 0;
+    printf("{\n");
+    printf("  \"tests\": %u,\n", (uint32_t)tests.size());
+    printf("  \"frames\": %u,\n", frames);
+    printf("  \"seconds\": %.3f,\n", seconds);
+    printf("  \"results\": [");
+
+    for (size_t i = 0; i < tests.size(); i++)
+    {
+        const TestResult &result = results[i];
+        const char *status = update ? "updated" : "pass";
+        int64_t mismatch = -1;
+        double budget = 0;
+
+        if (result.header.status != TEST_OK)
+        {
+            status = errorNames[result.header.status];
+        }
+        else if (!update)
+        {
+            std::map<std::string, Golden>::iterator it = golden.find(tests[i].name);
+            if (it == golden.end())
+            {
+                status = "no golden results";
+            }
+            else
+            {
+                // Find the first checkpoint that differs, including ones only one side has
+                budget = it->second.budget;
+                std::map<uint32_t, uint64_t> hashes;
+                for (size_t j = 0; j < result.checkpoints.size(); j++)
+                    hashes[result.checkpoints[j].frame] = result.checkpoints[j].hash;
+                for (std::map<uint32_t, uint64_t>::iterator h = hashes.begin(); h != hashes.end() && mismatch < 0; h++)
+                {
+                    std::map<uint32_t, uint64_t>::iterator g = it->second.hashes.find(h->first);
+                    if (g == it->second.hashes.end() || g->second != h->second)
+                        mismatch = h->first;
+                }
+                for (std::map<uint32_t, uint64_t>::iterator g = it->second.hashes.begin(); g != it->second.hashes.end(); g++)
+                {
+                    if (!hashes.count(g->first) && (mismatch < 0 || g->first < mismatch))
+                        mismatch = g->first;
+                }
+
+                if (mismatch >= 0)
+                    status = "hash mismatch";
+                else if (budget > 0 && result.header.meanMs > budget * (1 + tolerance / 100))
+                    status = "over budget";
+            }
+        }
+
+        if (!update && strcmp(status, "pass"))
+            failed++;
+        if (update && result.header.status != TEST_OK)
+            failed++;
+
+        printf("%s\n    { \"test\": \"%s\", \"status\": \"%s\"", i ? "," : "", escapeJson(tests[i].name.c_str()).c_str(), status);
+        if (result.header.status == TEST_OK)
+            printf(", \"mean_ms\": %.3f, \"max_ms\": %.3f", result.header.meanMs, result.header.maxMs);
+        if (budget > 0)
+            printf(", \"budget_ms\": %.3f", budget);
+        if (mismatch >= 0)
+            printf(", \"first_mismatch\": %lld", (long long)mismatch);
+        printf(" }");
+    }
+
+    printf("\n  ],\n");
+    printf("  \"failed\": %u\n", failed);
+    printf("}\n");
+    return failed ? 2 : 0;
+}
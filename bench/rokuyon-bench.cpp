@@ -0,0 +1,452 @@
+/*
+    Copyright 2022-2024 Hydr8gon
+
+    This file is part of rokuyon.
+
+    rokuyon is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    rokuyon is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with rokuyon. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifndef WINDOWS
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "../src/ai.h"
+#include "../src/core.h"
+#include "../src/dma.h"
+#include "../src/movie.h"
+#include "../src/pif.h"
+#include "../src/profiler.h"
+#include "../src/rdp.h"
+#include "../src/rdp_capture.h"
+#include "../src/settings.h"
+#include "../src/trace.h"
+#include "../src/vi.h"
+#include "script.h"
+
+// Runs a ROM headless for a number of frames as fast as possible and reports performance as JSON
+// Usage: rokuyon-bench [options] <rom>
+//   -f, --frames <n>     Number of frames to measure (default 3600)
+//   -w, --warmup <n>     Number of frames to run before measuring (default 0)
+//   -s, --script <file>  Input script to replay, with lines of "<frame> press|release <button>"
+//                        or "<frame> stick <x> <y>", applied before the given frame runs
+//   -r, --record-input <file> Record controller input as the game polls it into an input movie
+//   -p, --play-input <file>   Replay an input movie from boot, replacing any scripted input
+//   --threaded-rdp       Run the RDP on its own thread
+//   --expansion-pak      Use the 8MB RDRAM configuration
+//   --perf-stats         Also measure host time per subsystem, at a small cost
+//   --trace <file>       Record a timeline of the measured frames in Chrome trace format
+//   --profile <file>     Sample guest CPU and RSP addresses during the measured frames into a text profile
+//   --symbols <file>     Map file to name profiled addresses, with "<address> <name>" or "<name> = <address>;" lines
+//   --capture-rdp <file> Record the RDP commands of the measured frames for rdp-replay (slows emulation down)
+//   --overdraw <prefix>  Write an overdraw heatmap for each measured frame as <prefix><frame>.ppm
+//   -j, --jobs <n>       Run n copies of the emulator in parallel processes and report aggregate throughput
+//                        Each job is a forked process, since emulator state is global to a process
+// When built with RDP_COUNTERS=1, RDP fill-rate counters for the measured frames are also reported
+
+struct JobResult
+{
+    double seconds;
+    double startupMs;
+    double frameTimeMean;
+    double frameTimeP99;
+    uint64_t cpuOpcodes;
+    uint64_t rspOpcodes;
+};
+
+#ifdef RDP_COUNTERS
+static uint64_t sumCounter(const RdpCounters &counters, int type)
+{
+    // Total a fill-rate counter over every cycle type and texture format
+    uint64_t sum = 0;
+    for (int i = 0; i < RDP_CYCLE_TYPES; i++)
+        for (int j = 0; j < RDP_COUNTER_FORMATS; j++)
+            sum += counters.pixels[type][i][j];
+    return sum;
+}
+#endif
+
+#ifndef WINDOWS
+static int reportJobs(const char *romPath, uint32_t frames, int results[2], std::vector<pid_t> &children)
+{
+    // Collect a result from each job as it finishes
+    std::vector<JobResult> jobs;
+    JobResult result;
+    close(results[1]);
+    while (read(results[0], &result, sizeof(result)) == sizeof(result))
+        jobs.push_back(result);
+    close(results[0]);
+
+    // Wait for the jobs to exit, and fail if any of them didn't finish cleanly
+    bool failed = false;
+    for (size_t i = 0; i < children.size(); i++)
+    {
+        int status;
+        if (waitpid(children[i], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed = true;
+    }
+
+    if (failed || jobs.empty() || jobs.size() != children.size())
+    {
+        fprintf(stderr, "Failed to get results from all jobs\n");
+        return 1;
+    }
+
+    // Total the throughput of the jobs, which ran at the same time, and keep the worst startup and p99 frame times
+    double fps = 0, minFps = 0, maxFps = 0, seconds = 0, startup = 0, cpuMips = 0, rspMips = 0, mean = 0, p99 = 0;
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        double jobFps = frames / jobs[i].seconds;
+        fps += jobFps;
+        minFps = i ? std::min(minFps, jobFps) : jobFps;
+        maxFps = std::max(maxFps, jobFps);
+        seconds = std::max(seconds, jobs[i].seconds);
+        startup = std::max(startup, jobs[i].startupMs);
+        cpuMips += jobs[i].cpuOpcodes / jobs[i].seconds / 1000000;
+        rspMips += jobs[i].rspOpcodes / jobs[i].seconds / 1000000;
+        mean += jobs[i].frameTimeMean / jobs.size();
+        p99 = std::max(p99, jobs[i].frameTimeP99);
+    }
+
+    // Report the results
+    printf("{\n");
+    printf("  \"rom\": \"%s\",\n", escapeJson(romPath).c_str());
+    printf("  \"jobs\": %u,\n", (uint32_t)jobs.size());
+    printf("  \"frames\": %u,\n", frames);
+    printf("  \"seconds\": %.3f,\n", seconds);
+    printf("  \"startup_ms\": %.2f,\n", startup);
+    printf("  \"aggregate_fps\": %.2f,\n", fps);
+    printf("  \"fps_per_job\": { \"min\": %.2f, \"mean\": %.2f, \"max\": %.2f },\n", minFps, fps / jobs.size(), maxFps);
+    printf("  \"cpu_mips\": %.2f,\n", cpuMips);
+    printf("  \"rsp_mips\": %.2f,\n", rspMips);
+    printf("  \"frame_time_ms\": {\n");
+    printf("    \"mean\": %.3f,\n", mean);
+    printf("    \"p99\": %.3f\n", p99);
+    printf("  }\n");
+    printf("}\n");
+    return 0;
+}
+#endif
+
+int main(int argc, char **argv)
+{
+    const char *romPath = nullptr;
+    const char *scriptPath = nullptr;
+    const char *recordPath = nullptr;
+    const char *playPath = nullptr;
+    const char *tracePath = nullptr;
+    const char *profilePath = nullptr;
+    const char *capturePath = nullptr;
+    const char *overdrawPrefix = nullptr;
+    uint32_t frames = 3600;
+    uint32_t warmup = 0;
+    uint32_t jobs = 1;
+    bool valid = true;
+
+    // Use a fixed configuration so results are comparable, and run uncapped
+    Settings::fpsLimiter = 0;
+    Settings::expansionPak = 0;
+    Settings::threadedRdp = 0;
+    Settings::mmapSaves = 0;
+
+    // Parse the command line
+    for (int i = 1; i < argc; i++)
+    {
+        if ((!strcmp(argv[i], "-f") || !strcmp(argv[i], "--frames")) && i + 1 < argc)
+            frames = atoi(argv[++i]);
+        else if ((!strcmp(argv[i], "-w") || !strcmp(argv[i], "--warmup")) && i + 1 < argc)
+            warmup = atoi(argv[++i]);
+        else if ((!strcmp(argv[i], "-s") || !strcmp(argv[i], "--script")) && i + 1 < argc)
+            scriptPath = argv[++i];
+        else if ((!strcmp(argv[i], "-r") || !strcmp(argv[i], "--record-input")) && i + 1 < argc)
+            recordPath = argv[++i];
+        else if ((!strcmp(argv[i], "-p") || !strcmp(argv[i], "--play-input")) && i + 1 < argc)
+            playPath = argv[++i];
+        else if (!strcmp(argv[i], "--threaded-rdp"))
+            Settings::threadedRdp = 1;
+        else if (!strcmp(argv[i], "--expansion-pak"))
+            Settings::expansionPak = 1;
+        else if (!strcmp(argv[i], "--perf-stats"))
+            Settings::perfStats = 1;
+        else if (!strcmp(argv[i], "--trace") && i + 1 < argc)
+            tracePath = argv[++i];
+        else if (!strcmp(argv[i], "--profile") && i + 1 < argc)
+            profilePath = argv[++i];
+        else if (!strcmp(argv[i], "--symbols") && i + 1 < argc)
+            Settings::profileMap = argv[++i];
+        else if (!strcmp(argv[i], "--capture-rdp") && i + 1 < argc)
+            capturePath = argv[++i];
+        else if (!strcmp(argv[i], "--overdraw") && i + 1 < argc)
+            overdrawPrefix = argv[++i];
+        else if ((!strcmp(argv[i], "-j") || !strcmp(argv[i], "--jobs")) && i + 1 < argc)
+            jobs = atoi(argv[++i]);
+        else if (argv[i][0] != '-' && !romPath)
+            romPath = argv[i];
+        else
+            valid = false;
+    }
+
+#ifndef RDP_COUNTERS
+    // Overdraw is tracked by the fill-rate counters, which have to be compiled in
+    if (overdrawPrefix)
+    {
+        fprintf(stderr, "Overdraw heatmaps need a build with RDP_COUNTERS=1\n");
+        return 1;
+    }
+#endif
+
+#ifdef WINDOWS
+    // Jobs are forked from the booted emulator, which isn't possible here
+    if (jobs > 1)
+    {
+        fprintf(stderr, "Parallel jobs aren't supported on this platform\n");
+        return 1;
+    }
+#endif
+
+    // Jobs would all write to the same output files, so don't allow both
+    if (jobs > 1 && (tracePath || profilePath || capturePath || overdrawPrefix || recordPath))
+    {
+        fprintf(stderr, "Traces, profiles, captures, overdraw, and input movies can only be written with 1 job\n");
+        return 1;
+    }
+
+    if (!valid || !romPath || frames == 0 || jobs == 0 || (recordPath && playPath))
+    {
+        fprintf(stderr, "Usage: %s [-f frames] [-w warmup] [-s script] [-r movie | -p movie] [--threaded-rdp] [--expansion-pak] [--perf-stats] [--trace file] [--profile file] [--symbols map] [--capture-rdp file] [--overdraw prefix] [-j jobs] <rom>\n", argv[0]);
+        return 1;
+    }
+
+    // Load the input script if one was given
+    std::vector<InputEvent> events;
+    if (scriptPath && !loadScript(scriptPath, events))
+    {
+        fprintf(stderr, "Failed to load input script: %s\n", scriptPath);
+        return 1;
+    }
+
+    // Start the input movie before booting, so its polls are counted from the PIF reset
+    if (recordPath && !Movie::record(recordPath))
+    {
+        fprintf(stderr, "Failed to record input movie: %s\n", recordPath);
+        return 1;
+    }
+    if (playPath && !Movie::play(playPath))
+    {
+        fprintf(stderr, "Failed to load input movie: %s\n", playPath);
+        return 1;
+    }
+
+    // Boot the ROM without starting the emulator thread, and never write the save file
+    if (!Core::bootRom(romPath))
+    {
+        fprintf(stderr, "Failed to load ROM: %s\n", romPath);
+        return 1;
+    }
+    Core::savePath = "";
+
+#ifndef WINDOWS
+    // Fork a process for each job from the booted emulator, since its state is global to the process
+    // The children share the ROM and other read-only data with this one, and get their own copies of the rest
+    int results[2];
+    bool child = false;
+    if (jobs > 1)
+    {
+        if (pipe(results))
+        {
+            fprintf(stderr, "Failed to create a pipe for job results\n");
+            return 1;
+        }
+
+        std::vector<pid_t> children;
+        for (uint32_t i = 0; i < jobs && !child; i++)
+        {
+            pid_t pid = fork();
+            if (pid == 0)
+                child = true;
+            else if (pid > 0)
+                children.push_back(pid);
+            else
+                fprintf(stderr, "Failed to start job %u\n", i);
+        }
+
+        if (!child)
+            return reportJobs(romPath, frames, results, children);
+        close(results[0]);
+    }
+#endif
+
+    std::vector<double> frameTimes;
+    frameTimes.reserve(frames);
+    static uint32_t samples[0x2000];
+    size_t next = 0;
+    CoreStats start = {};
+    std::chrono::steady_clock::time_point startTime;
+#ifdef RDP_COUNTERS
+    RdpCounters startCounters, lastCounters, counters;
+    uint64_t peakTested = 0, peakWritten = 0;
+#endif
+
+    for (uint32_t i = 0; i < warmup + frames; i++)
+    {
+        // Begin measuring once the warmup frames are done
+        if (i == warmup)
+        {
+            Settings::trace = (tracePath != nullptr);
+            Settings::profiler = (profilePath != nullptr);
+            Profiler::reset();
+            if (capturePath && !RDP_Capture::start(capturePath))
+                fprintf(stderr, "Failed to start RDP capture: %s\n", capturePath);
+            start = Core::getStats();
+            startTime = std::chrono::steady_clock::now();
+#ifdef RDP_COUNTERS
+            RDP::getCounters(startCounters);
+            RDP::clearOverdraw();
+            lastCounters = startCounters;
+#endif
+        }
+
+        // Apply scripted input for this frame
+        applyScript(events, next, i);
+
+        // Run a frame and consume its output like a frontend would
+        std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+        Core::runFrame();
+        if (_Framebuffer *fb = VI::getFramebuffer())
+            delete fb;
+        AI::drainBuffer(samples, sizeof(samples) / sizeof(*samples));
+
+        if (i < warmup) continue;
+        frameTimes.push_back(std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - frameStart).count());
+
+#ifdef RDP_COUNTERS
+        // Track the busiest frame for fill rate, and write its overdraw if requested
+        RDP::getCounters(counters);
+        peakTested = std::max(peakTested, sumCounter(counters, PIXELS_TESTED) - sumCounter(lastCounters, PIXELS_TESTED));
+        peakWritten = std::max(peakWritten, sumCounter(counters, PIXELS_WRITTEN) - sumCounter(lastCounters, PIXELS_WRITTEN));
+        lastCounters = counters;
+
+        if (overdrawPrefix)
+        {
+            char path[1024];
+            snprintf(path, sizeof(path), "%s%05u.ppm", overdrawPrefix, i - warmup);
+            if (!RDP::writeOverdraw(path))
+                fprintf(stderr, "Failed to write overdraw: %s\n", path);
+        }
+#endif
+    }
+
+    // Calculate the totals over the measured frames
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    CoreStats end = Core::getStats();
+    RDP_Capture::stop();
+    Core::stop();
+    Movie::stop();
+    if (tracePath && !Trace::dump(tracePath))
+        fprintf(stderr, "Failed to write trace: %s\n", tracePath);
+    if (profilePath && !Profiler::dump(profilePath))
+        fprintf(stderr, "Failed to write profile: %s\n", profilePath);
+
+    double total = 0;
+    for (size_t i = 0; i < frameTimes.size(); i++)
+        total += frameTimes[i];
+    std::sort(frameTimes.begin(), frameTimes.end());
+
+#ifndef WINDOWS
+    if (child)
+    {
+        // Send the results of this job to the parent instead of reporting them
+        JobResult result = { seconds, Core::startupTime, total / frameTimes.size(), percentile(frameTimes, 99),
+            end.cpuOpcodes - start.cpuOpcodes, end.rspOpcodes - start.rspOpcodes };
+        bool sent = (write(results[1], &result, sizeof(result)) == sizeof(result));
+        _exit(sent ? 0 : 1);
+    }
+#endif
+
+    // Report the results
+    printf("{\n");
+    printf("  \"rom\": \"%s\",\n", escapeJson(romPath).c_str());
+    printf("  \"frames\": %u,\n", frames);
+    printf("  \"seconds\": %.3f,\n", seconds);
+    printf("  \"startup_ms\": %.2f,\n", Core::startupTime);
+    printf("  \"fps\": %.2f,\n", frames / seconds);
+    printf("  \"cpu_mips\": %.2f,\n", (end.cpuOpcodes - start.cpuOpcodes) / seconds / 1000000);
+    printf("  \"rsp_mips\": %.2f,\n", (end.rspOpcodes - start.rspOpcodes) / seconds / 1000000);
+    printf("  \"rdp_pixels_per_sec\": %.0f,\n", (end.rdpPixels - start.rdpPixels) / seconds);
+    printf("  \"per_frame\": {\n");
+    printf("    \"events\": %.1f,\n", double(end.events - start.events) / frames);
+    printf("    \"rdp_commands\": %.1f,\n", double(end.rdpCommands - start.rdpCommands) / frames);
+    printf("    \"pi_dma_bytes\": %.1f,\n", double(end.dmaBytes[DMA_PI] - start.dmaBytes[DMA_PI]) / frames);
+    printf("    \"si_dma_bytes\": %.1f,\n", double(end.dmaBytes[DMA_SI] - start.dmaBytes[DMA_SI]) / frames);
+    printf("    \"sp_dma_bytes\": %.1f", double(end.dmaBytes[DMA_SP] - start.dmaBytes[DMA_SP]) / frames);
+    if (Settings::perfStats)
+    {
+        // Host times are only measured when enabled
+        printf(",\n    \"cpu_ms\": %.3f,\n", (end.cpuTime - start.cpuTime) / 1000000.0 / frames);
+        printf("    \"rsp_ms\": %.3f,\n", (end.rspTime - start.rspTime) / 1000000.0 / frames);
+        printf("    \"rdp_ms\": %.3f,\n", (end.rdpTime - start.rdpTime) / 1000000.0 / frames);
+        printf("    \"vi_ms\": %.3f", (end.viTime - start.viTime) / 1000000.0 / frames);
+    }
+    printf("\n  },\n");
+    printf("  \"audio_underruns\": %llu,\n", (unsigned long long)(end.audioUnderruns - start.audioUnderruns));
+
+#ifdef RDP_COUNTERS
+    // Report fill-rate counters per frame, in total and for each cycle type and texture format that was used
+    printf("  \"rdp_counters\": {\n");
+    printf("    \"per_frame\": {");
+    for (int i = 0; i < MAX_RDP_COUNTERS; i++)
+        printf("%s\"%s\": %.1f", i ? ", " : " ", RDP::counterNames[i],
+            double(sumCounter(counters, i) - sumCounter(startCounters, i)) / frames);
+    printf(" },\n");
+    printf("    \"peak_frame\": { \"tested\": %llu, \"written\": %llu },\n",
+        (unsigned long long)peakTested, (unsigned long long)peakWritten);
+    printf("    \"breakdown\": [");
+    bool first = true;
+    for (int i = 0; i < RDP_CYCLE_TYPES; i++)
+    {
+        for (int j = 0; j < RDP_COUNTER_FORMATS; j++)
+        {
+            if (counters.pixels[PIXELS_TESTED][i][j] == startCounters.pixels[PIXELS_TESTED][i][j])
+                continue;
+            printf("%s\n      { \"cycle\": \"%s\", \"format\": \"%s\"", first ? "" : ",",
+                RDP::cycleNames[i], RDP::formatNames[j]);
+            for (int k = 0; k < MAX_RDP_COUNTERS; k++)
+                printf(", \"%s\": %.1f", RDP::counterNames[k],
+                    double(counters.pixels[k][i][j] - startCounters.pixels[k][i][j]) / frames);
+            printf(" }");
+            first = false;
+        }
+    }
+    printf("\n    ]\n");
+    printf("  },\n");
+#endif
+    printf("  \"frame_time_ms\": {\n");
+    printf("    \"mean\": %.3f,\n", total / frameTimes.size());
+    printf("    \"p50\": %.3f,\n", percentile(frameTimes, 50));
+    printf("    \"p90\": %.3f,\n", percentile(frameTimes, 90));
+    printf("    \"p99\": %.3f,\n", percentile(frameTimes, 99));
+    printf("    \"max\": %.3f\n", frameTimes.back());
+    printf("  }\n");
+    printf("}\n");
+    return 0;
+}
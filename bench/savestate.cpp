@@ -0,0 +1,99 @@
+/*
+    Copyright 2022-2024 Hydr8gon
+
+    This file is part of rokuyon.
+
+    rokuyon is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    rokuyon is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with rokuyon. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "../src/core.h"
+#include "../src/settings.h"
+
+// Measures save state size and save/load latency after running a ROM for a few seconds
+// Usage: savestate <rom> [iterations] [seconds]
+
+static double toMicros(std::chrono::steady_clock::duration duration)
+{
+    return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+static void printStats(const char *name, std::vector<double> &times)
+{
+    // Print the average, median, and worst time of a set of measurements
+    std::sort(times.begin(), times.end());
+    double total = 0;
+    for (size_t i = 0; i < times.size(); i++)
+        total += times[i];
+    printf("%s: avg %.1fus, median %.1fus, max %.1fus\n", name,
+        total / times.size(), times[times.size() / 2], times.back());
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        printf("Usage: %s <rom> [iterations] [seconds]\n", argv[0]);
+        return 1;
+    }
+
+    int iterations = (argc > 2) ? atoi(argv[2]) : 1000;
+    int seconds = (argc > 3) ? atoi(argv[3]) : 2;
+
+    // Use the 4MB RDRAM configuration and run uncapped
+    Settings::fpsLimiter = 0;
+    Settings::expansionPak = 0;
+    Settings::threadedRdp = 0;
+
+    // Boot the ROM and let it run for a bit so the state isn't trivial
+    if (!Core::bootRom(argv[1]))
+    {
+        printf("Failed to load ROM: %s\n", argv[1]);
+        return 1;
+    }
+    Core::start();
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    Core::shutdown();
+
+    size_t size = Core::stateSize();
+    std::vector<uint8_t> state(size), check(size);
+    std::vector<double> saveTimes, loadTimes;
+    printf("State size: %zu bytes\n", size);
+
+    for (int i = 0; i < iterations; i++)
+    {
+        // Time a save followed by a load of the same state
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        Core::saveState(state.data(), size);
+        std::chrono::steady_clock::time_point middle = std::chrono::steady_clock::now();
+        Core::loadState(state.data(), size);
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+        saveTimes.push_back(toMicros(middle - start));
+        loadTimes.push_back(toMicros(end - middle));
+    }
+
+    // Make sure a loaded state saves back out identically
+    Core::saveState(check.data(), size);
+    printf("Round trip: %s\n", (state == check) ? "match" : "MISMATCH");
+
+    printStats("Save", saveTimes);
+    printStats("Load", loadTimes);
+    return (state == check) ? 0 : 1;
+}
@@ -0,0 +1,138 @@
+/*
+    Copyright 2022-2024 Hydr8gon
+
+    This file is part of rokuyon.
+
+    rokuyon is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    rokuyon is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with rokuyon. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../src/pif.h"
+
+// Helpers shared by the bench tools
+// Input scripts have lines of "<frame> press|release <button>" or "<frame> stick <x> <y>"
+
+struct InputEvent
+{
+    uint32_t frame;
+    int key; // -1 for stick
+    bool pressed;
+    int stickX, stickY;
+};
+
+static const char *const buttonNames[] =
+{
+    "a", "b", "z", "start", "up", "down", "left", "right",
+    "", "", "l", "r", "cup", "cdown", "cleft", "cright"
+};
+
+inline bool loadScript(const char *path, std::vector<InputEvent> &events)
+{
+    FILE *file = fopen(path, "r");
+    if (!file) return false;
+
+    char line[256];
+    int number = 0;
+    while (fgets(line, sizeof(line), file))
+    {
+        // Skip empty lines and comments
+        number++;
+        char *start = line + strspn(line, " \t");
+        if (*start == '#' || *start == '\n' || *start == '\0')
+            continue;
+
+        // Parse a button or stick event
+        InputEvent event = {};
+        char command[16], arg[16];
+        int count = sscanf(start, "%u %15s %15s %d", &event.frame, command, arg, &event.stickY);
+        if (count == 4 && !strcmp(command, "stick"))
+        {
+            event.key = -1;
+            event.stickX = atoi(arg);
+        }
+        else if (count == 3 && (!strcmp(command, "press") || !strcmp(command, "release")))
+        {
+            event.key = 16;
+            event.pressed = !strcmp(command, "press");
+            for (int i = 0; i < 16; i++)
+            {
+                if (!strcmp(arg, buttonNames[i]))
+                    event.key = i;
+            }
+        }
+        else
+        {
+            event.key = 16;
+        }
+
+        if (event.key == 16)
+        {
+            fprintf(stderr, "Invalid input script line %d: %s", number, line);
+            fclose(file);
+            return false;
+        }
+        events.push_back(event);
+    }
+
+    // Apply events in frame order, keeping the file order for events on the same frame
+    std::stable_sort(events.begin(), events.end(),
+        [](const InputEvent &a, const InputEvent &b) { return a.frame < b.frame; });
+    fclose(file);
+    return true;
+}
+
+inline void applyScript(const std::vector<InputEvent> &events, size_t &next, uint32_t frame)
+{
+    // Apply the events for a frame, and any earlier ones that haven't been applied yet
+    for (; next < events.size() && events[next].frame <= frame; next++)
+    {
+        const InputEvent &event = events[next];
+        if (event.key < 0)
+            PIF::setStick(event.stickX, event.stickY);
+        else if (event.pressed)
+            PIF::pressKey(event.key);
+        else
+            PIF::releaseKey(event.key);
+    }
+}
+
+inline std::string escapeJson(const char *str)
+{
+    // Escape a string so it can be placed in quotes
+    std::string out;
+    for (; *str; str++)
+    {
+        if (*str == '"' || *str == '\\') out += '\\';
+        if ((uint8_t)*str >= 0x20) out += *str;
+    }
+    return out;
+}
+
+inline double percentile(const std::vector<double> &sorted, double p)
+{
+    // Get a percentile from sorted values using the nearest rank
+    size_t rank = (size_t)(p / 100 * sorted.size() + 0.5);
+    return sorted[std::min(std::max<size_t>(rank, 1), sorted.size()) - 1];
+}
+
+#endif // SCRIPT_H
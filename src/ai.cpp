@@ -17,11 +17,23 @@
     along with rokuyon. If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
 #include <cstring>
-#include <queue>
-#include <thread>
-#include <vector>
+#include <mutex>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 #include "ai.h"
 #include "core.h"
@@ -29,11 +41,26 @@
 #include "memory.h"
 #include "mi.h"
 #include "settings.h"
-
-#define MAX_BUFFERS 4
-#define SAMPLE_COUNT 1024
+#include "state.h"
+#include "trace.h"
+
+#define RING_SIZE 0x2000
+#define PERIOD_SIZE 512
+#define MAX_LATENCY 2048
+#define TARGET_FILL 2048
+#define MAX_ADJUST 0.005f
 #define OUTPUT_RATE 48000
-#define OUTPUT_SIZE SAMPLE_COUNT * sizeof(uint32_t)
+
+#define CHUNK_SIZE 1024
+#define SINC_TAPS 16
+#define SINC_PHASES 256
+
+static const double kPi = 3.14159265358979323846;
+
+enum Quality
+{
+    LINEAR = 0, CUBIC, SINC
+};
 
 struct Samples
 {
@@ -43,41 +70,109 @@ struct Samples
 
 namespace AI
 {
-    uint32_t bufferOut[SAMPLE_COUNT];
-    std::atomic<bool> ready;
+    // Single-producer, single-consumer sample ring shared with the audio thread
+    // Samples in [readPos, releasePos) can be output, and [releasePos, writePos) are still pending
+    uint32_t ring[RING_SIZE];
+    std::atomic<uint32_t> readPos;
+    std::atomic<uint32_t> releasePos;
+    uint32_t writePos;
+    uint32_t lastSample;
+    uint32_t lastOutput;
+
+    std::mutex mutex;
+    std::condition_variable dataCond;
+    std::condition_variable spaceCond;
+
+    std::atomic<float> rateAdjust;
+    std::atomic<uint32_t> underruns;
+    std::atomic<uint32_t> overruns;
+
+    alignas(16) float input[(CHUNK_SIZE + SINC_TAPS) * 2];
+    alignas(16) float sincTable[SINC_PHASES + 1][SINC_TAPS * 2];
+    uint32_t inputCount;
+    uint64_t position;
+    uint64_t step;
+    uint32_t tableFreq;
 
     Samples samples[2];
-    std::queue<std::vector<uint32_t>> buffers;
-    uint32_t offset;
-
     uint32_t dramAddr;
     uint32_t control;
     uint32_t frequency;
     uint32_t status;
 
-    void createBuffer();
+    void buildSincTable();
+    uint32_t packSample(float l, float r);
+    template <int quality> bool resample(uint32_t read);
+
     void submitBuffer();
-    void processBuffer();
 }
 
-void AI::fillBuffer(uint32_t *out)
+AudioStats AI::getStats()
+{
+    // Get the current audio buffer metrics
+    AudioStats stats;
+    stats.fillLevel = releasePos.load(std::memory_order_relaxed) - readPos.load(std::memory_order_relaxed);
+    stats.rateAdjust = rateAdjust.load(std::memory_order_relaxed);
+    stats.underruns = underruns.load(std::memory_order_relaxed);
+    stats.overruns = overruns.load(std::memory_order_relaxed);
+    return stats;
+}
+
+bool AI::underrunLikely()
+{
+    // Check if the audio thread is about to run out of released samples
+    return releasePos.load(std::memory_order_relaxed) - readPos.load(std::memory_order_relaxed) < PERIOD_SIZE;
+}
+
+void AI::fillBuffer(uint32_t *out, uint32_t count)
 {
-    // Try to wait until a buffer is ready, but don't stall the audio callback too long
-    std::chrono::steady_clock::time_point waitTime = std::chrono::steady_clock::now();
-    while (!ready.load())
+    // Try to wait until enough samples are released, but don't stall the audio callback too long
+    // With dynamic rate control, the fill level is managed ahead of time, so don't wait at all
+    Trace::setThreadName("Audio");
+    uint64_t start = Trace::begin();
+    uint32_t read = readPos.load(std::memory_order_relaxed);
+    if (!Settings::dynamicRate)
     {
-        if (std::chrono::steady_clock::now() - waitTime > std::chrono::microseconds(1000000 / 60))
-        {
-            // If a buffer isn't ready in time, fill the output with the last played sample
-            for (int i = 0; i < SAMPLE_COUNT; i++)
-                out[i] = bufferOut[SAMPLE_COUNT - 1];
-            return;
-        }
+        std::unique_lock<std::mutex> lock(mutex);
+        dataCond.wait_for(lock, std::chrono::microseconds(1000000 / 60), [&]
+            { return !Core::running || releasePos.load(std::memory_order_acquire) - read >= count; });
     }
 
-    // Output the buffer and mark it as used
-    memcpy(out, bufferOut, OUTPUT_SIZE);
-    ready.store(false);
+    // If samples ran out, fill the rest of the output with the last played sample
+    uint32_t size = drainBuffer(out, count);
+    for (uint32_t i = size; i < count; i++)
+        out[i] = lastOutput;
+
+    // Keep track of how often the output runs dry
+    if (size < count)
+        underruns.fetch_add(1, std::memory_order_relaxed);
+    Trace::end("Fill Audio Buffer", start, size);
+}
+
+uint32_t AI::drainBuffer(uint32_t *out, uint32_t count)
+{
+    // Copy as many released samples as are available without waiting, wrapping around the end of the ring
+    uint32_t read = readPos.load(std::memory_order_relaxed);
+    uint32_t size = std::min(count, releasePos.load(std::memory_order_acquire) - read);
+    uint32_t index = read & (RING_SIZE - 1);
+    uint32_t first = std::min(size, RING_SIZE - index);
+    memcpy(out, &ring[index], first * sizeof(uint32_t));
+    memcpy(&out[first], ring, (size - first) * sizeof(uint32_t));
+    if (size > 0) lastOutput = out[size - 1];
+
+    // Free the used samples and let the emulator know there's space
+    std::lock_guard<std::mutex> guard(mutex);
+    readPos.store(read + size, std::memory_order_release);
+    spaceCond.notify_one();
+    return size;
+}
+
+void AI::wake()
+{
+    // Wake the emulator and audio threads so they can see that emulation stopped
+    std::lock_guard<std::mutex> guard(mutex);
+    spaceCond.notify_all();
+    dataCond.notify_all();
 }
 
 void AI::reset()
@@ -88,8 +183,49 @@ void AI::reset()
     frequency = 0;
     status = 0;
 
-    // Schedule the first audio buffer to output
-    Core::schedule(createBuffer, (uint64_t)SAMPLE_COUNT * (93750000 * 2) / OUTPUT_RATE);
+    // Empty the sample ring and wake anything waiting on it
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        readPos.store(0);
+        releasePos.store(0);
+        spaceCond.notify_all();
+    }
+    writePos = 0;
+    lastSample = 0;
+    lastOutput = 0;
+    rateAdjust.store(0);
+    underruns.store(0);
+    overruns.store(0);
+
+    // Reset the resampler with a window of silence before the first input
+    memset(input, 0, sizeof(input));
+    inputCount = SINC_TAPS;
+    position = (uint64_t)(SINC_TAPS / 2 - 1) << 32;
+    tableFreq = 0;
+
+    // Schedule the first period of samples to be released
+    Core::schedule(AI_CREATE_BUFFER, (uint64_t)PERIOD_SIZE * (93750000 * 2) / OUTPUT_RATE);
+}
+
+void AI::saveState(State &state)
+{
+    // Save the AI registers and queued sample buffers
+    // The host-side ring and resampler are left alone so playback continues smoothly
+    state.write(dramAddr);
+    state.write(control);
+    state.write(frequency);
+    state.write(status);
+    state.write(samples);
+}
+
+void AI::loadState(State &state)
+{
+    // Load the AI registers and queued sample buffers
+    state.read(dramAddr);
+    state.read(control);
+    state.read(frequency);
+    state.read(status);
+    state.read(samples);
 }
 
 uint32_t AI::read(uint32_t address)
@@ -161,39 +297,151 @@ void AI::write(uint32_t address, uint32_t value)
 
 void AI::createBuffer()
 {
-    // Wait until the previous buffer has been used
-    while (Settings::fpsLimiter && Core::running && ready.load())
-        std::this_thread::yield();
+    // Release samples on a fixed schedule unless dynamic rate control releases them as they're submitted
+    // Frames that will never be heard don't release anything
+    uint32_t release = releasePos.load(std::memory_order_relaxed);
+    if (Settings::dynamicRate || Core::skipAudio)
+        goto schedule;
+
+    // Wait until the audio thread has room for another period, unless running unlimited
+    if (Settings::fpsLimiter)
+    {
+        uint64_t start = Trace::begin();
+        std::unique_lock<std::mutex> lock(mutex);
+        spaceCond.wait(lock, [&]
+            { return !Core::running || release - readPos.load(std::memory_order_acquire) < MAX_LATENCY; });
+        Trace::end("Wait For Audio", start);
+    }
 
-    memset(bufferOut, 0, OUTPUT_SIZE);
-    size_t count = 0;
+    if (release - readPos.load(std::memory_order_acquire) < MAX_LATENCY)
+    {
+        // Pad the pending samples with the last one if the game didn't submit enough
+        while (writePos - release < PERIOD_SIZE)
+            ring[writePos++ & (RING_SIZE - 1)] = lastSample;
+
+        // Release a period of samples to the audio thread
+        std::lock_guard<std::mutex> guard(mutex);
+        releasePos.store(release + PERIOD_SIZE, std::memory_order_release);
+        dataCond.notify_one();
+    }
+    else
+    {
+        // Drop a period of pending samples if the audio thread is too far behind
+        writePos -= std::min<uint32_t>(PERIOD_SIZE, writePos - release);
+    }
 
-    while (!buffers.empty() && count < OUTPUT_SIZE)
+schedule:
+    // Schedule the next period of samples to be released
+    Core::schedule(AI_CREATE_BUFFER, (uint64_t)PERIOD_SIZE * (93750000 * 2) / OUTPUT_RATE);
+}
+
+void AI::buildSincTable()
+{
+    // Cut off at the input or output Nyquist frequency, whichever is lower
+    double cutoff = std::min(1.0, (double)OUTPUT_RATE / frequency) * 0.95;
+    tableFreq = frequency;
+
+    // Calculate Blackman-windowed sinc coefficients for each fractional phase
+    // Coefficients are stored twice in a row so they can be applied to interleaved stereo frames
+    for (int p = 0; p <= SINC_PHASES; p++)
+    {
+        double coeffs[SINC_TAPS], sum = 0;
+        for (int j = 0; j < SINC_TAPS; j++)
+        {
+            double x = (j - (SINC_TAPS / 2 - 1)) - (double)p / SINC_PHASES;
+            double s = (x == 0) ? 1 : sin(kPi * x * cutoff) / (kPi * x * cutoff);
+            double w = 0.42 + 0.5 * cos(kPi * x / (SINC_TAPS / 2)) + 0.08 * cos(2 * kPi * x / (SINC_TAPS / 2));
+            sum += (coeffs[j] = s * w);
+        }
+
+        // Normalize the coefficients so the filter has unity gain
+        for (int j = 0; j < SINC_TAPS; j++)
+            sincTable[p][j * 2 + 0] = sincTable[p][j * 2 + 1] = coeffs[j] / sum;
+    }
+}
+
+inline uint32_t AI::packSample(float l, float r)
+{
+    // Round and clamp a stereo frame to 16-bit, with the left channel in the low half
+    int32_t left = std::max(-0x8000, std::min(0x7FFF, (int32_t)std::lrint(l)));
+    int32_t right = std::max(-0x8000, std::min(0x7FFF, (int32_t)std::lrint(r)));
+    return ((uint16_t)right << 16) | (uint16_t)left;
+}
+
+template <int quality> bool AI::resample(uint32_t read)
+{
+    bool dropped = false;
+
+    // Generate output frames until the filter would need input that hasn't been received
+    while ((position >> 32) + SINC_TAPS / 2 < inputCount)
     {
-        // Get the current queued buffer and the size of its remaining samples
-        std::vector<uint32_t> &buffer = buffers.front();
-        size_t size = (buffer.size() - offset) * sizeof(uint32_t);
+        const float *frame = &input[(position >> 32) * 2];
+        float frac = (uint32_t)position * (1.0f / 4294967296.0f);
+        float l, r;
 
-        if (size <= OUTPUT_SIZE - count)
+        if (quality == LINEAR)
+        {
+            // Interpolate linearly between the 2 nearest frames
+            l = frame[0] + (frame[2] - frame[0]) * frac;
+            r = frame[1] + (frame[3] - frame[1]) * frac;
+        }
+        else if (quality == CUBIC)
         {
-            // Copy all of the remaining queued samples to the output buffer
-            memcpy(&bufferOut[count / sizeof(uint32_t)], &buffer[offset], size);
-            count += size;
-            offset = 0;
-            buffers.pop();
+            // Interpolate with a Catmull-Rom spline through the 4 nearest frames
+            float c[4];
+            float f2 = frac * frac, f3 = f2 * frac;
+            c[0] = 0.5f * (-f3 + 2 * f2 - frac);
+            c[1] = 0.5f * (3 * f3 - 5 * f2 + 2);
+            c[2] = 0.5f * (-3 * f3 + 4 * f2 + frac);
+            c[3] = 0.5f * (f3 - f2);
+            l = c[0] * frame[-2] + c[1] * frame[0] + c[2] * frame[2] + c[3] * frame[4];
+            r = c[0] * frame[-1] + c[1] * frame[1] + c[2] * frame[3] + c[3] * frame[5];
         }
         else
         {
-            // Copy as many queued samples that can fit to the output buffer
-            memcpy(&bufferOut[count / sizeof(uint32_t)], &buffer[offset], OUTPUT_SIZE - count);
-            offset += (OUTPUT_SIZE - count) / sizeof(uint32_t);
-            break;
+            // Look up the 2 nearest coefficient phases and the weight between them
+            uint32_t phase = (uint32_t)position >> (32 - 8);
+            const float *c0 = sincTable[phase];
+            const float *c1 = sincTable[phase + 1];
+            const float *taps = &frame[-(SINC_TAPS / 2 - 1) * 2];
+            float weight = ((uint32_t)position & 0xFFFFFF) * (1.0f / 0x1000000);
+
+#ifdef __SSE__
+            // Apply the filter to both channels at once, 2 frames per vector
+            __m128 w = _mm_set1_ps(weight);
+            __m128 sum = _mm_setzero_ps();
+            for (int j = 0; j < SINC_TAPS * 2; j += 4)
+            {
+                __m128 a = _mm_load_ps(&c0[j]);
+                __m128 c = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&c1[j]), a), w));
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(&taps[j]), c));
+            }
+
+            // Add the high frame sums to the low ones to get the final left and right values
+            float out[4];
+            _mm_storeu_ps(out, _mm_add_ps(sum, _mm_movehl_ps(sum, sum)));
+            l = out[0];
+            r = out[1];
+#else
+            // Apply the filter to both channels
+            l = r = 0;
+            for (int j = 0; j < SINC_TAPS * 2; j += 2)
+            {
+                l += taps[j + 0] * (c0[j + 0] + (c1[j + 0] - c0[j + 0]) * weight);
+                r += taps[j + 1] * (c0[j + 1] + (c1[j + 1] - c0[j + 1]) * weight);
+            }
+#endif
         }
+
+        // Add the frame to the ring if there's space, or drop it
+        if (writePos - read < RING_SIZE)
+            ring[writePos++ & (RING_SIZE - 1)] = lastSample = packSample(l, r);
+        else
+            dropped = true;
+        position += step;
     }
 
-    // Mark the buffer as ready and schedule the next one
-    ready.store(true);
-    Core::schedule(createBuffer, (uint64_t)SAMPLE_COUNT * (93750000 * 2) / OUTPUT_RATE);
+    return dropped;
 }
 
 void AI::submitBuffer()
@@ -201,26 +449,95 @@ void AI::submitBuffer()
     LOG_INFO("Submitting %d AI samples from RDRAM 0x%X at frequency %dHz\n",
         samples[0].count, samples[0].address, frequency);
 
-    if (buffers.size() < MAX_BUFFERS)
+    // Schedule the logical completion of the AI DMA based on sample count and frequency
+    Core::schedule(AI_PROCESS_BUFFER, (uint64_t)samples[0].count * (93750000 * 2) / frequency);
+
+    // Skip resampling for frames that will never be heard
+    if (Core::skipAudio)
+        return;
+
+    // Steer the fill level towards its target by slightly adjusting the resampling ratio
+    // This absorbs the difference between the host's audio clock and the rate emulation is paced at
+    uint32_t read = readPos.load(std::memory_order_acquire);
+    float adjust = 0;
+    if (Settings::dynamicRate)
     {
-        // Create a new audio buffer based on sample count and frequency
-        size_t count = samples[0].count * OUTPUT_RATE / frequency;
-        std::vector<uint32_t> buffer(count);
+        adjust = MAX_ADJUST * ((int32_t)(writePos - read) - TARGET_FILL) / TARGET_FILL;
+        adjust = std::max(-MAX_ADJUST, std::min(MAX_ADJUST, adjust));
+    }
+    rateAdjust.store(adjust, std::memory_order_relaxed);
+
+    // Update the resampling ratio, and rebuild the sinc filter if the frequency changed
+    step = (uint64_t)((double)frequency * (1 + adjust) * 4294967296.0 / OUTPUT_RATE);
+    if (Settings::audioQuality == SINC && tableFreq != frequency)
+        buildSincTable();
+
+    uint32_t address = samples[0].address;
+    bool dropped = false;
 
-        // Copy samples to the buffer, scaled from their original frequency
-        for (size_t i = 0; i < count; i++)
+    for (uint32_t i = 0; i < samples[0].count; i += CHUNK_SIZE)
+    {
+        // Convert a chunk of big-endian 16-bit stereo samples from RDRAM to floats
+        uint32_t count = std::min<uint32_t>(CHUNK_SIZE, samples[0].count - i);
+        float *dst = &input[inputCount * 2];
+        if (address + count * 4 <= Memory::ramSize)
         {
-            uint32_t address = samples[0].address + (i * samples[0].count / count) * 4;
-            uint32_t value = Memory::read<uint32_t>(0xA0000000 + address);
-            buffer[i] = (value << 16) | (value >> 16);
+            // Swap bytes and widen 8 samples at a time if possible, like ROM conversion
+            const uint8_t *src = &Memory::rdram[address];
+            uint32_t j = 0;
+#if defined(__SSE2__)
+            for (; j + 8 <= count * 2; j += 8)
+            {
+                __m128i v = _mm_loadu_si128((__m128i*)&src[j * 2]);
+                v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+                _mm_storeu_ps(&dst[j + 0], _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)));
+                _mm_storeu_ps(&dst[j + 4], _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16)));
+            }
+#elif defined(__ARM_NEON)
+            for (; j + 8 <= count * 2; j += 8)
+            {
+                int16x8_t v = vreinterpretq_s16_u8(vrev16q_u8(vld1q_u8(&src[j * 2])));
+                vst1q_f32(&dst[j + 0], vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))));
+                vst1q_f32(&dst[j + 4], vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))));
+            }
+#endif
+            for (; j < count * 2; j++)
+                dst[j] = (int16_t)((src[j * 2] << 8) | src[j * 2 + 1]);
+        }
+        else
+        {
+            // Output silence for samples outside of RDRAM
+            memset(dst, 0, count * 2 * sizeof(float));
+        }
+        inputCount += count;
+        address += count * 4;
+
+        // Resample the chunk to the output rate using the selected quality
+        switch (Settings::audioQuality)
+        {
+            case LINEAR: dropped |= resample<LINEAR>(read); break;
+            case CUBIC:  dropped |= resample<CUBIC>(read);  break;
+            default:     dropped |= resample<SINC>(read);   break;
         }
 
-        // Add the buffer to the output queue
-        buffers.push(buffer);
+        // Keep the last few frames as history for the next chunk
+        uint32_t shift = inputCount - SINC_TAPS;
+        memmove(input, &input[shift * 2], SINC_TAPS * 2 * sizeof(float));
+        position -= (uint64_t)shift << 32;
+        inputCount = SINC_TAPS;
     }
 
-    // Schedule the logical completion of the AI DMA based on sample count and frequency
-    Core::schedule(processBuffer, (uint64_t)samples[0].count * (93750000 * 2) / frequency);
+    // Keep track of how often samples are dropped because the output is too far behind
+    if (dropped)
+        overruns.fetch_add(1, std::memory_order_relaxed);
+
+    // With dynamic rate control, release the samples to the audio thread right away
+    if (Settings::dynamicRate)
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        releasePos.store(writePos, std::memory_order_release);
+        dataCond.notify_one();
+    }
 }
 
 void AI::processBuffer()
@@ -22,13 +22,32 @@
 
 #include <cstdint>
 
+struct State;
+
+struct AudioStats
+{
+    uint32_t fillLevel;
+    float rateAdjust;
+    uint32_t underruns;
+    uint32_t overruns;
+};
+
 namespace AI
 {
-    void fillBuffer(uint32_t *out);
+    AudioStats getStats();
+    bool underrunLikely();
+    void fillBuffer(uint32_t *out, uint32_t count);
+    uint32_t drainBuffer(uint32_t *out, uint32_t count);
+    void wake();
 
     void reset();
+    void saveState(State &state);
+    void loadState(State &state);
     uint32_t read(uint32_t address);
     void write(uint32_t address, uint32_t value);
+
+    void createBuffer();
+    void processBuffer();
 }
 
 #endif // AI_H
@@ -18,35 +18,70 @@
 */
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
 #include <cstring>
 #include <thread>
 #include <vector>
 
+#if !defined(_WIN32) && !defined(__SWITCH__)
+#define USE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include "core.h"
 #include "ai.h"
 #include "cpu.h"
 #include "cpu_cp0.h"
 #include "cpu_cp1.h"
+#include "dma.h"
 #include "log.h"
 #include "memory.h"
 #include "mi.h"
 #include "pi.h"
 #include "pif.h"
+#include "profiler.h"
 #include "rdp.h"
+#include "rdp_capture.h"
+#include "rewind.h"
 #include "rsp.h"
 #include "rsp_cp0.h"
 #include "rsp_cp2.h"
+#include "settings.h"
 #include "si.h"
+#include "state.h"
+#include "trace.h"
 #include "vi.h"
 
+#define SAVE_BLOCK 0x80
+#define MAX_SAVE_SIZE 0x20000 // FLASH 128KB
+#define MAX_BLOCKS (MAX_SAVE_SIZE / SAVE_BLOCK)
+
+#define STATE_MAGIC 0x554B4F52 // "ROKU"
+#define STATE_VERSION 3
+#define STATE_TASKS 32
+
+#define SAMPLE_INTERVAL 256 // Opcodes per timing sample when performance stats are enabled
+
+// Headers of ROM formats that need converting; anything else is used as big-endian (.z64)
+#define N64_HEADER 0x40123780 // Little-endian (.n64)
+#define V64_HEADER 0x37804012 // Byte-swapped (.v64)
+
 struct Task
 {
-    Task(void (*function)(), uint32_t cycles):
-        function(function), cycles(cycles) {}
+    Task(TaskType type, uint32_t cycles):
+        type(type), cycles(cycles) {}
 
-    void (*function)();
+    TaskType type;
     uint32_t cycles;
 
     bool operator<(const Task &task) const
@@ -60,12 +95,26 @@ namespace Core
     std::thread *emuThread;
     std::thread *saveThread;
     std::condition_variable condVar;
+    std::condition_variable emuCond;
     std::mutex waitMutex;
+    std::mutex emuMutex;
     std::mutex saveMutex;
+    std::atomic<bool> exiting;
 
     bool running;
+    bool paused;
+    bool parked = true;
+    bool stepping;
+    bool frameDone;
     bool cpuRunning;
     bool rspRunning;
+    bool sampling;
+
+    bool skipVideo;
+    bool skipAudio;
+    bool skipRdp;
+    bool skipFrame;
+    int skipCount;
 
     std::vector<Task> tasks;
     uint32_t globalCycles;
@@ -74,23 +123,267 @@ namespace Core
 
     int fps;
     int fpsCount;
+    std::atomic<uint64_t> frameCount;
+    std::atomic<uint64_t> eventCount;
+    std::atomic<uint64_t> cpuOpcodes;
+    std::atomic<uint64_t> rspOpcodes;
+    std::atomic<uint64_t> cpuTime;
+    std::atomic<uint64_t> rspTime;
+    uint64_t clockOverhead;
+    float startupTime;
+    std::chrono::steady_clock::time_point bootTime;
     std::chrono::steady_clock::time_point lastFpsTime;
+    std::chrono::steady_clock::time_point nextFrameTime;
+    std::chrono::steady_clock::time_point lastSaveTime;
 
     std::string savePath;
     uint8_t *rom;
     uint8_t *save;
     uint32_t romSize;
     uint32_t saveSize;
-    bool saveDirty;
+    bool romMapped;
+    bool romOwned;
+    std::atomic<uint32_t> dirtyBlocks[MAX_BLOCKS / 32];
+    bool saveResized;
+    bool saveMapped;
 
+    uint32_t getRomHeader(const uint8_t *data, uint32_t size);
+    uint64_t hashRom();
+    std::string resumePath();
+    std::string tracePath();
+    std::string profilePath();
+    bool loadResume();
+    void writeResume();
+    void convertRom(uint8_t *dst, const uint8_t *src, uint32_t size, uint32_t header);
+    void emuLoop();
+    template <bool timed> void runOpcodes();
+    int64_t timeOpcode(void (*runOpcode)());
     void runLoop();
     void saveLoop();
+    uint8_t *mapSave(uint32_t size);
     void updateSave();
+    void takeDirty(uint32_t *dirty);
+    void restoreDirty(const uint32_t *dirty);
+    void writeHeader(State &state);
+    void writeState(State &state);
+    void readState(State &state);
     void resetCycles();
+    void profileSample();
+
+    extern void (*taskFuncs[])();
+    extern const char *taskNames[];
+}
+
+// Functions to call for each type of scheduled task
+void (*Core::taskFuncs[MAX_TASKS])() =
+{
+    resetCycles, AI::createBuffer, AI::processBuffer, VI::drawFrame, CPU_CP0::updateCount,
+    CPU_CP0::interrupt, PI::finishDma, SI::finishDma, RSP_CP0::finishDma, profileSample
+};
+
+// Names to show in traces for each type of scheduled task
+const char *Core::taskNames[MAX_TASKS] =
+{
+    "Reset Cycles", "AI Create Buffer", "AI Process Buffer", "VI Draw Frame", "CP0 Update Count",
+    "CP0 Interrupt", "PI Finish DMA", "SI Finish DMA", "SP Finish DMA", "Profile Sample"
+};
+
+uint32_t Core::getRomHeader(const uint8_t *data, uint32_t size)
+{
+    // Get the first four bytes of a ROM, which identify its byte order
+    if (size < 4) return 0;
+    return (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+}
+
+void Core::convertRom(uint8_t *dst, const uint8_t *src, uint32_t size, uint32_t header)
+{
+    // Convert a ROM to big-endian byte order, which can be done in place
+    uint32_t i = 0;
+    switch (header)
+    {
+        case N64_HEADER:
+            // Reverse bytes in 4-byte chunks, 16 bytes at a time if possible
+            LOG_INFO("Detected ROM format: N64\n");
+#if defined(__SSE2__)
+            for (; i + 16 <= size; i += 16)
+            {
+                __m128i v = _mm_loadu_si128((__m128i*)&src[i]);
+                v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+                v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xB1), 0xB1);
+                _mm_storeu_si128((__m128i*)&dst[i], v);
+            }
+#elif defined(__ARM_NEON)
+            for (; i + 16 <= size; i += 16)
+                vst1q_u8(&dst[i], vrev32q_u8(vld1q_u8(&src[i])));
+#endif
+            for (; i + 4 <= size; i += 4)
+            {
+                uint8_t b0 = src[i + 0], b1 = src[i + 1];
+                dst[i + 0] = src[i + 3];
+                dst[i + 1] = src[i + 2];
+                dst[i + 2] = b1;
+                dst[i + 3] = b0;
+            }
+            break;
+
+        case V64_HEADER:
+            // Swap adjacent bytes in 2-byte chunks, 16 bytes at a time if possible
+            LOG_INFO("Detected ROM format: V64\n");
+#if defined(__SSE2__)
+            for (; i + 16 <= size; i += 16)
+            {
+                __m128i v = _mm_loadu_si128((__m128i*)&src[i]);
+                v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+                _mm_storeu_si128((__m128i*)&dst[i], v);
+            }
+#elif defined(__ARM_NEON)
+            for (; i + 16 <= size; i += 16)
+                vst1q_u8(&dst[i], vrev16q_u8(vld1q_u8(&src[i])));
+#endif
+            for (; i + 2 <= size; i += 2)
+            {
+                uint8_t b0 = src[i];
+                dst[i + 0] = src[i + 1];
+                dst[i + 1] = b0;
+            }
+            break;
+
+        default:
+            // Copy other formats as-is
+            LOG_INFO("Detected ROM format: Z64\n");
+            break;
+    }
+
+    // Copy any remaining bytes that weren't converted
+    if (dst != src)
+        memcpy(&dst[i], &src[i], size - i);
+}
+
+void Core::loadRom(const uint8_t *data, uint32_t size, bool persistent)
+{
+    // Use ROM data that's already in memory, only copying it if it needs conversion or won't stay valid
+    unloadRom();
+    romSize = size;
+    uint32_t header = getRomHeader(data, size);
+
+    if (persistent && (header != N64_HEADER && header != V64_HEADER))
+    {
+        rom = (uint8_t*)data;
+        return;
+    }
+
+    rom = new uint8_t[size];
+    romOwned = true;
+    convertRom(rom, data, size, header);
+}
+
+void Core::unloadRom()
+{
+    // Free the current ROM, depending on how it was loaded
+#ifdef USE_MMAP
+    if (romMapped)
+        munmap(rom, romSize);
+    else
+#endif
+    if (romOwned)
+        delete[] rom;
+
+    rom = nullptr;
+    romSize = 0;
+    romMapped = false;
+    romOwned = false;
+}
+
+uint64_t Core::hashRom()
+{
+    // Identify the ROM with an FNV-1a hash of its header and boot code, which include the cart checksums
+    uint64_t hash = 0xCBF29CE484222325;
+    for (uint32_t i = 0; i < std::min(romSize, 0x1000U); i++)
+        hash = (hash ^ rom[i]) * 0x100000001B3;
+    return hash ^ romSize;
+}
+
+std::string Core::resumePath()
+{
+    // Derive the resume snapshot path from the save path
+    return savePath.substr(0, savePath.rfind(".")) + ".resume";
+}
+
+std::string Core::tracePath()
+{
+    // Derive the trace output path from the save path
+    return savePath.substr(0, savePath.rfind(".")) + ".trace.json";
+}
+
+std::string Core::profilePath()
+{
+    // Derive the profile output path from the save path
+    return savePath.substr(0, savePath.rfind(".")) + ".profile.txt";
+}
+
+bool Core::loadResume()
+{
+    // Try to open a resume snapshot and check that it's the right size for the current configuration
+    FILE *file = fopen(resumePath().c_str(), "rb");
+    if (!file) return false;
+    size_t size = stateSize();
+    fseek(file, 0, SEEK_END);
+    if ((size_t)ftell(file) != size + sizeof(uint64_t))
+    {
+        fclose(file);
+        return false;
+    }
+
+#ifdef USE_MMAP
+    // Map the snapshot so it's read straight from the page cache without an extra copy
+    void *map = mmap(nullptr, size + sizeof(uint64_t), PROT_READ, MAP_PRIVATE, fileno(file), 0);
+    fclose(file);
+    if (map == MAP_FAILED) return false;
+    uint8_t *data = (uint8_t*)map;
+#else
+    // Read the snapshot into memory
+    uint8_t *data = new uint8_t[size + sizeof(uint64_t)];
+    fseek(file, 0, SEEK_SET);
+    fread(data, sizeof(uint8_t), size + sizeof(uint64_t), file);
+    fclose(file);
+#endif
+
+    // Load the snapshot if it was taken with the same ROM
+    uint64_t hash;
+    memcpy(&hash, data, sizeof(hash));
+    bool loaded = (hash == hashRom() && loadState(&data[sizeof(uint64_t)], size));
+
+#ifdef USE_MMAP
+    munmap(map, size + sizeof(uint64_t));
+#else
+    delete[] data;
+#endif
+    return loaded;
+}
+
+void Core::writeResume()
+{
+    // Write a snapshot of the machine tagged with the ROM hash, so the next boot can pick up from here
+    size_t size = stateSize();
+    std::vector<uint8_t> data(size + sizeof(uint64_t));
+    uint64_t hash = hashRom();
+    memcpy(&data[0], &hash, sizeof(hash));
+    saveState(&data[sizeof(uint64_t)], size);
+
+    if (FILE *file = fopen(resumePath().c_str(), "wb"))
+    {
+        LOG_INFO("Writing resume snapshot to disk\n");
+        fwrite(data.data(), sizeof(uint8_t), data.size(), file);
+        fclose(file);
+    }
 }
 
-bool Core::bootRom(const std::string &path)
+bool Core::bootRom(const std::string &path, bool resume)
 {
+    // Keep track of when the ROM was booted to measure startup time
+    bootTime = std::chrono::steady_clock::now();
+    startupTime = 0;
+
 #ifndef __LIBRETRO__
     // Try to open the specified ROM file
     FILE *romFile = fopen(path.c_str(), "rb");
@@ -99,29 +392,64 @@ bool Core::bootRom(const std::string &path)
     // Ensure the emulator is stopped
     stop();
 
-    // Load the ROM into memory
-    if (rom) delete[] rom;
+    // Get the size and format of the ROM
+    unloadRom();
     fseek(romFile, 0, SEEK_END);
     romSize = ftell(romFile);
     fseek(romFile, 0, SEEK_SET);
-    rom = new uint8_t[romSize];
-    fread(rom, sizeof(uint8_t), romSize, romFile);
+    uint8_t head[4] = {};
+    fread(head, sizeof(uint8_t), 4, romFile);
+    fseek(romFile, 0, SEEK_SET);
+    uint32_t header = getRomHeader(head, romSize);
+
+#ifdef USE_MMAP
+    // Map big-endian ROMs directly from the file, so they're used in place and paged in on demand
+    if (header != N64_HEADER && header != V64_HEADER && romSize > 0)
+    {
+        void *data = mmap(nullptr, romSize, PROT_READ, MAP_PRIVATE, fileno(romFile), 0);
+        if (data != MAP_FAILED)
+        {
+            rom = (uint8_t*)data;
+            romMapped = true;
+        }
+    }
+#endif
+
+    // Load the ROM into memory if it wasn't mapped, converting it to big-endian in place
+    if (!romMapped)
+    {
+        rom = new uint8_t[romSize];
+        romOwned = true;
+        fread(rom, sizeof(uint8_t), romSize, romFile);
+        convertRom(rom, rom, romSize, header);
+    }
     fclose(romFile);
 
     // Derive the save path from the ROM path
     savePath = path.substr(0, path.rfind(".")) + ".sav";
 #endif
-    if (save) delete[] save;
-    saveDirty = false;
+    unloadSave();
+    for (int i = 0; i < MAX_BLOCKS / 32; i++)
+        dirtyBlocks[i].store(0);
+    saveResized = false;
 
     if (FILE *saveFile = fopen(savePath.c_str(), "rb"))
     {
-        // Load the save file into memory if it exists
+        // Get the size of the save file if it exists
         fseek(saveFile, 0, SEEK_END);
         saveSize = ftell(saveFile);
         fseek(saveFile, 0, SEEK_SET);
-        save = new uint8_t[saveSize];
-        fread(save, sizeof(uint8_t), saveSize, saveFile);
+
+        // Map the save file into memory if enabled, or load it normally
+        if (Settings::mmapSaves && saveSize > 0 && (save = mapSave(saveSize)))
+        {
+            saveMapped = true;
+        }
+        else
+        {
+            save = new uint8_t[saveSize];
+            fread(save, sizeof(uint8_t), saveSize, saveFile);
+        }
         fclose(saveFile);
     }
     else
@@ -134,13 +462,15 @@ bool Core::bootRom(const std::string &path)
 
     // Reset the scheduler
     cpuRunning = true;
-    tasks.clear();
-    globalCycles = 0;
-    cpuCycles = 0;
-    rspCycles = 0;
-    schedule(resetCycles, 0x7FFFFFFF);
+    resetScheduler();
+    Profiler::reset();
+
+    // Draw frames normally until frameskip decides otherwise
+    skipFrame = false;
+    skipCount = 0;
 
     // Reset the emulated components
+    Rewind::reset();
     Memory::reset();
     AI::reset();
     CPU::reset();
@@ -156,7 +486,14 @@ bool Core::bootRom(const std::string &path)
     RSP_CP0::reset();
     RSP_CP2::reset();
 
-#ifndef __LIBRETRO__
+    // Restore the machine from the last session if enabled and the snapshot matches this ROM
+    if (resume && Settings::instantResume && loadResume())
+    {
+        LOG_INFO("Resumed from snapshot in %.2fms\n",
+            std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - bootTime).count());
+    }
+
+#if !defined(__LIBRETRO__) && !defined(HEADLESS)
     // Start the emulator
     start();
 #endif
@@ -165,86 +502,302 @@ bool Core::bootRom(const std::string &path)
 
 void Core::resizeSave(uint32_t newSize)
 {
-    // Create a save with the new size
+    // Copy a mapped save out first, since shrinking the file invalidates the end of the old mapping
     saveMutex.lock();
-    uint8_t *newSave = new uint8_t[newSize];
+    std::vector<uint8_t> oldData;
+    const uint8_t *oldSave = save;
+    if (saveMapped)
+    {
+        oldData.assign(save, save + saveSize);
+        oldSave = oldData.data();
+    }
+
+    // Create a save with the new size, resizing and mapping the save file if enabled
+    uint8_t *newSave = (Settings::mmapSaves && newSize > 0) ? mapSave(newSize) : nullptr;
+    bool mapped = (newSave != nullptr);
+    if (!mapped) newSave = new uint8_t[newSize];
+
+    // If the old and new saves are both mappings of the file, they already share data
+    bool shared = (saveMapped && mapped);
 
     if (saveSize < newSize) // New save is larger
     {
         // Copy all of the old save and fill the rest with 0xFF
-        memcpy(newSave, save, saveSize * sizeof(uint8_t));
+        if (!shared) memcpy(newSave, oldSave, saveSize * sizeof(uint8_t));
         memset(&newSave[saveSize], 0xFF, (newSize - saveSize) * sizeof(uint8_t));
     }
     else // New save is smaller
     {
         // Copy as much of the old save as possible
-        memcpy(newSave, save, newSize * sizeof(uint8_t));
+        if (!shared) memcpy(newSave, oldSave, newSize * sizeof(uint8_t));
     }
 
     // Swap the old save for the new one
-    delete[] save;
+    unloadSave();
     save = newSave;
     saveSize = newSize;
-    saveDirty = true;
+    saveMapped = mapped;
+    saveResized = true;
     saveMutex.unlock();
     updateSave();
 }
 
+void Core::unloadSave()
+{
+    // Free the current save, unmapping it if it's mapped to the save file
+#ifdef USE_MMAP
+    if (saveMapped)
+        munmap(save, saveSize);
+    else
+#endif
+        delete[] save;
+
+    save = nullptr;
+    saveMapped = false;
+}
+
 void Core::start()
 {
-    // Start the threads if emulation wasn't running
+    // Create the threads the first time emulation starts; they persist until shutdown
+    if (!emuThread)
+    {
+        emuThread = new std::thread(emuLoop);
+        saveThread = new std::thread(saveLoop);
+    }
+
+    // Wake the emulator thread if emulation wasn't running
+    std::lock_guard<std::mutex> guard(emuMutex);
     if (!running)
     {
         running = true;
-        emuThread = new std::thread(runLoop);
-        saveThread = new std::thread(saveLoop);
+        paused = false;
+        emuCond.notify_all();
     }
 }
 
-void Core::stop()
+void Core::pause()
 {
     if (running)
     {
         {
-            // Signal for the threads to stop
-            std::lock_guard<std::mutex> guard(waitMutex);
+            // Signal for the emulator thread to park, and wait until it has
+            std::unique_lock<std::mutex> lock(emuMutex);
             running = false;
-            condVar.notify_one();
+            emuCond.notify_all();
+            AI::wake();
+            emuCond.wait(lock, []{ return parked; });
         }
 
-        // Stop the threads if emulation was running
-        emuThread->join();
-        saveThread->join();
-        delete emuThread;
-        delete saveThread;
-        RDP::finishThread();
+        // Wait for the save thread to finish an update in progress, then update the save here
+        { std::lock_guard<std::mutex> guard(waitMutex); }
+        updateSave();
+        RDP::stopThread();
+        paused = true;
+    }
+    else
+    {
+        // Frames run on the caller's thread have no save thread, so update the save here
+        // The RDP thread is kept between frames, so stop it now
+        updateSave();
+        RDP::stopThread();
     }
 }
 
-void Core::runLoop()
+void Core::stop()
 {
-    while (running)
+    // Pause emulation, remembering if a threaded session was running or paused
+    bool session = running || paused;
+    pause();
+    paused = false;
+
+    // Take a snapshot to resume from next time if enabled
+    if (session && Settings::instantResume && rom)
+        writeResume();
+
+    // Write out anything that was traced or profiled while running
+    if (!savePath.empty())
+    {
+        Trace::dump(tracePath());
+        Profiler::dump(profilePath());
+    }
+}
+
+void Core::shutdown()
+{
+    // Stop emulation before ending the threads
+    stop();
+    if (!emuThread) return;
+
     {
-        // Run the CPUs until the next scheduled task
-        while (tasks[0].cycles > globalCycles)
+        // Signal for the parked threads to exit
+        std::lock_guard<std::mutex> guard(emuMutex);
+        std::lock_guard<std::mutex> guard2(waitMutex);
+        exiting.store(true);
+        emuCond.notify_all();
+        condVar.notify_one();
+    }
+
+    // Join the threads so they can be recreated if emulation starts again
+    emuThread->join();
+    saveThread->join();
+    delete emuThread;
+    delete saveThread;
+    emuThread = saveThread = nullptr;
+    exiting.store(false);
+}
+
+void Core::runFrame()
+{
+    // Run the emulator on the calling thread until the next frame is finished
+    // The threads must be stopped, and nothing else runs concurrently, so results are deterministic
+    running = stepping = true;
+    Trace::setThreadName("Emulator");
+    runLoop();
+    running = stepping = false;
+
+    // Every few seconds, check if the save file should be updated
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (now - lastSaveTime >= std::chrono::seconds(3))
+    {
+        lastSaveTime = now;
+        updateSave();
+    }
+}
+
+void Core::emuLoop()
+{
+    std::unique_lock<std::mutex> lock(emuMutex);
+    while (true)
+    {
+        // Park at a safe point until emulation is started or the thread should exit
+        // Frames run on the caller's thread also set the running flag, so ignore those
+        parked = true;
+        emuCond.notify_all();
+        emuCond.wait(lock, []{ return (running && !stepping) || exiting.load(); });
+        if (exiting.load()) return;
+        parked = false;
+
+        // Run the emulator until it's signaled to stop
+        lock.unlock();
+        Trace::setThreadName("Emulator");
+        runLoop();
+        lock.lock();
+    }
+}
+
+CoreStats Core::getStats()
+{
+    // Get the running totals of emulated work, which can be compared between calls
+    CoreStats stats;
+    stats.frames = frameCount.load(std::memory_order_relaxed);
+    stats.events = eventCount.load(std::memory_order_relaxed);
+    stats.cpuOpcodes = cpuOpcodes.load(std::memory_order_relaxed);
+    stats.rspOpcodes = rspOpcodes.load(std::memory_order_relaxed);
+    stats.cpuTime = cpuTime.load(std::memory_order_relaxed);
+    stats.rspTime = rspTime.load(std::memory_order_relaxed);
+    stats.audioUnderruns = AI::getStats().underruns;
+
+    // Let other components fill in their parts
+    RDP::getStats(stats);
+    VI::getStats(stats);
+    DMA::getStats(stats);
+    return stats;
+}
+
+uint64_t Core::hostTime()
+{
+    // Get a host timestamp in nanoseconds for measuring performance
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+template <bool timed> void Core::runOpcodes()
+{
+    // Time the whole run exactly when timed, leaving out RDP work that runs inline
+    uint64_t rdpStart = timed ? RDP::getInlineTime() : 0;
+    uint64_t start = timed ? hostTime() : 0;
+
+    // Run the CPUs until the next scheduled task
+    // Sampling continues from the totals, so short runs between tasks aren't always sampled first
+    uint32_t cpuCount = 0, rspCount = 0;
+    uint32_t cpuBase = cpuOpcodes.load(std::memory_order_relaxed);
+    uint32_t rspBase = rspOpcodes.load(std::memory_order_relaxed);
+    int64_t cpuSamples = 0, rspSamples = 0;
+    while (tasks[0].cycles > globalCycles)
+    {
+        // Run a CPU opcode if ready and schedule the next one
+        if (cpuRunning && globalCycles >= cpuCycles)
         {
-            // Run a CPU opcode if ready and schedule the next one
-            if (cpuRunning && globalCycles >= cpuCycles)
-            {
+            // When timed, sample one in every so many opcodes to see how time splits between the CPUs
+            if (timed && !((cpuBase + cpuCount) & (SAMPLE_INTERVAL - 1)))
+                cpuSamples += timeOpcode(CPU::runOpcode);
+            else
                 CPU::runOpcode();
-                cpuCycles = globalCycles + 2;
-            }
+            cpuCycles = globalCycles + 2;
+            cpuCount++;
+        }
 
-            // Run an RSP opcode if ready and schedule the next one
-            if (rspRunning && globalCycles >= rspCycles)
-            {
+        // Run an RSP opcode if ready and schedule the next one
+        if (rspRunning && globalCycles >= rspCycles)
+        {
+            if (timed && !((rspBase + rspCount) & (SAMPLE_INTERVAL - 1)))
+                rspSamples += timeOpcode(RSP::runOpcode);
+            else
                 RSP::runOpcode();
-                rspCycles = globalCycles + 3;
-            }
+            rspCycles = globalCycles + 3;
+            rspCount++;
+        }
+
+        // Jump to the next soonest opcode
+        globalCycles = std::min<uint32_t>(cpuRunning ? cpuCycles : -1, rspRunning ? rspCycles : -1);
+    }
+
+    // Add the opcodes that ran to the totals; only this thread writes them, so no atomic add is needed
+    cpuOpcodes.store(cpuOpcodes.load(std::memory_order_relaxed) + cpuCount, std::memory_order_relaxed);
+    rspOpcodes.store(rspOpcodes.load(std::memory_order_relaxed) + rspCount, std::memory_order_relaxed);
 
-            // Jump to the next soonest opcode
-            globalCycles = std::min<uint32_t>(cpuRunning ? cpuCycles : -1, rspRunning ? rspCycles : -1);
+    if (timed)
+    {
+        // Split the measured time between the CPUs by their samples, or by opcode counts if there are none
+        int64_t total = hostTime() - start - (RDP::getInlineTime() - rdpStart);
+        double cpuWeight = std::max<int64_t>(cpuSamples, 0), rspWeight = std::max<int64_t>(rspSamples, 0);
+        if (cpuWeight + rspWeight == 0)
+            cpuWeight = cpuCount, rspWeight = rspCount;
+        uint64_t cpuShare = (cpuWeight + rspWeight > 0 && total > 0) ? total * cpuWeight / (cpuWeight + rspWeight) : 0;
+        uint64_t rspShare = (total > 0) ? total - cpuShare : 0;
+        cpuTime.store(cpuTime.load(std::memory_order_relaxed) + cpuShare, std::memory_order_relaxed);
+        rspTime.store(rspTime.load(std::memory_order_relaxed) + rspShare, std::memory_order_relaxed);
+    }
+}
+
+int64_t Core::timeOpcode(void (*runOpcode)())
+{
+    // Measure the overhead of reading the clock once, so it can be taken out of samples
+    if (!clockOverhead)
+    {
+        clockOverhead = -1;
+        for (int i = 0; i < 32; i++)
+        {
+            uint64_t start = hostTime();
+            clockOverhead = std::min<uint64_t>(clockOverhead, hostTime() - start);
         }
+    }
+
+    // Time a single opcode, leaving out RDP work that runs inline
+    uint64_t rdp = RDP::getInlineTime(), start = hostTime();
+    (*runOpcode)();
+    return int64_t(hostTime() - start - (RDP::getInlineTime() - rdp)) - int64_t(clockOverhead);
+}
+
+void Core::runLoop()
+{
+    while (running)
+    {
+        // Run the CPUs, with timing instrumentation only if enabled
+        if (Settings::perfStats)
+            runOpcodes<true>();
+        else
+            runOpcodes<false>();
 
         // Jump to the next scheduled task
         globalCycles = tasks[0].cycles;
@@ -252,23 +805,82 @@ void Core::runLoop()
         // Run all tasks that are scheduled now
         while (tasks[0].cycles <= globalCycles)
         {
-            (*tasks[0].function)();
+            TaskType type = tasks[0].type;
+            uint64_t start = Trace::begin();
+            (*taskFuncs[type])();
+            Trace::end(taskNames[type], start);
             tasks.erase(tasks.begin());
+            eventCount.store(eventCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+
+        // Handle the end of a frame once its tasks are done and the state is consistent
+        if (frameDone)
+        {
+            // Capture or restore rewind snapshots, except for frames that are run ahead and rolled back
+            frameDone = false;
+            if (Settings::rewind && !skipAudio)
+                Rewind::update();
+
+            // Mark the end of the frame in an RDP capture
+            if (RDP_Capture::isActive())
+                RDP_Capture::markFrame();
+
+            // Start sampling the guest if the profiler was enabled
+            if (Settings::profiler && !sampling)
+            {
+                sampling = true;
+                schedule(PROFILE_SAMPLE, Profiler::interval());
+            }
+
+            // Return from a single-frame run once the frame is finished
+            if (stepping)
+            {
+                running = false;
+            }
+            else if (Settings::fpsLimiter && Settings::framesAhead > 0)
+            {
+                // Wait at the frame boundary while too many frames are queued ahead of the presenter
+                uint64_t start = Trace::begin();
+                std::unique_lock<std::mutex> lock(emuMutex);
+                emuCond.wait(lock, []{ return !running || (int)VI::queuedFrames() < Settings::framesAhead; });
+                Trace::end("Wait For Presenter", start);
+            }
         }
     }
 }
 
 void Core::saveLoop()
 {
-    while (running)
+    std::unique_lock<std::mutex> lock(waitMutex);
+    while (!exiting.load())
     {
-        // Every few seconds, check if the save file should be updated
-        std::unique_lock<std::mutex> lock(waitMutex);
-        condVar.wait_for(lock, std::chrono::seconds(3), [&]{ return !running; });
-        updateSave();
+        // Every few seconds, check if the save file should be updated while emulation is running
+        condVar.wait_for(lock, std::chrono::seconds(3), []{ return exiting.load(); });
+        if (running) updateSave();
     }
 }
 
+void Core::framePresented()
+{
+    // Wake the emulator thread if it's waiting at a frame boundary for the presenter
+    std::lock_guard<std::mutex> guard(emuMutex);
+    emuCond.notify_all();
+}
+
+void Core::updateFrameskip(bool behind)
+{
+    // Skip frames when emulation falls behind, or at a fixed ratio
+    // The interval limits consecutive skips, so the display still updates eventually
+    bool skip = false;
+    if (Settings::frameskip == 1) // Auto
+        skip = behind && skipCount < Settings::frameskipInterval;
+    else if (Settings::frameskip == 2) // Fixed
+        skip = skipCount < Settings::frameskipInterval;
+
+    skipCount = skip ? (skipCount + 1) : 0;
+    skipFrame = skip;
+}
+
 void Core::countFrame()
 {
     // Calculate the time since the FPS was last updated
@@ -286,38 +898,340 @@ void Core::countFrame()
         // Count another frame
         fpsCount++;
     }
+
+    // Let the run loop know a frame finished
+    frameDone = true;
+    frameCount.store(frameCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+    // Decide whether to skip the next frame, unless frames are run on the caller's thread
+    // Audio is released on a fixed schedule, so a starving audio thread means emulation is behind
+    if (!stepping)
+        updateFrameskip(AI::underrunLikely());
+
+    // Measure the time from booting to the first frame
+    if (startupTime == 0)
+    {
+        startupTime = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - bootTime).count();
+        LOG_INFO("Startup took %.2fms\n", startupTime);
+    }
+
+    // Pace frames by wall-clock time when dynamic rate control stops audio from throttling
+    if (Settings::fpsLimiter && Settings::dynamicRate)
+    {
+        // Resynchronize instead of catching up if emulation fell too far behind
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (now - nextFrameTime > std::chrono::milliseconds(100))
+            nextFrameTime = now;
+        else
+            std::this_thread::sleep_until(nextFrameTime);
+
+        // Set the deadline for the next frame at 60Hz
+        nextFrameTime += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(1.0 / 60));
+    }
 }
 
 void Core::writeSave(uint32_t address, uint8_t value)
 {
-    // Safely write a byte of data to the current save
-    saveMutex.lock();
+    // Write a byte of data to the current save and mark its block as dirty
+    // This doesn't lock, so emulation never waits on the save thread
+    uint32_t block = address / SAVE_BLOCK;
     save[address] = value;
-    saveDirty = true;
-    saveMutex.unlock();
+    dirtyBlocks[block / 32].fetch_or(1U << (block & 31), std::memory_order_release);
+}
+
+uint8_t *Core::mapSave(uint32_t size)
+{
+#ifdef USE_MMAP
+    // Open or create the save file and set it to the requested size
+    int fd = open(savePath.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return nullptr;
+    if (ftruncate(fd, size) < 0)
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    // Map the file into memory so the kernel handles writing it back
+    void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return (data != MAP_FAILED) ? (uint8_t*)data : nullptr;
+#else
+    // Memory-mapped saves aren't supported on this platform
+    return nullptr;
+#endif
 }
 
 void Core::updateSave()
 {
-    // Update the save file if the data changed
-    saveMutex.lock();
-    if (saveDirty)
+    std::lock_guard<std::mutex> guard(saveMutex);
+
+#ifdef USE_MMAP
+    if (saveMapped)
+    {
+        // Flush a mapped save to disk if anything changed, since the data is already in the file
+        bool changed = saveResized;
+        for (int i = 0; i < MAX_BLOCKS / 32; i++)
+            changed |= dirtyBlocks[i].exchange(0, std::memory_order_acquire) != 0;
+        if (changed) msync(save, saveSize, MS_SYNC);
+        saveResized = false;
+        return;
+    }
+#endif
+
+    // Take the set of dirty blocks, clearing them before the data is read
+    // Any write that happens during the update marks its block again for the next one
+    uint32_t dirty[MAX_BLOCKS / 32];
+    takeDirty(dirty);
+
+    // Copy the dirty blocks right away, so the file is written from data that can't change underneath it
+    std::vector<uint32_t> blocks;
+    std::vector<uint8_t> data;
+    for (uint32_t i = 0; i < MAX_BLOCKS && i * SAVE_BLOCK < saveSize && !saveResized; i++)
     {
-        if (FILE *saveFile = fopen(savePath.c_str(), "wb"))
+        if (!(dirty[i / 32] & (1U << (i & 31))))
+            continue;
+        blocks.push_back(i);
+        data.insert(data.end(), &save[i * SAVE_BLOCK], &save[std::min<uint32_t>((i + 1) * SAVE_BLOCK, saveSize)]);
+    }
+
+    if (!saveResized)
+    {
+        if (blocks.empty()) return;
+
+#ifdef USE_MMAP
+        // Write only the dirty blocks at their offsets in the file, marking any that fail as dirty again
+        int fd = open(savePath.c_str(), O_WRONLY);
+        if (fd >= 0)
+        {
+            LOG_INFO("Writing dirty save blocks to disk\n");
+            uint32_t failed[MAX_BLOCKS / 32] = {};
+            for (size_t i = 0, offset = 0; i < blocks.size(); i++)
+            {
+                uint32_t size = std::min<uint32_t>(SAVE_BLOCK, saveSize - blocks[i] * SAVE_BLOCK);
+                if (pwrite(fd, &data[offset], size, blocks[i] * SAVE_BLOCK) != (ssize_t)size)
+                    failed[blocks[i] / 32] |= 1U << (blocks[i] & 31);
+                offset += size;
+            }
+            close(fd);
+            restoreDirty(failed);
+            return;
+        }
+#else
+        // Write only the dirty blocks at their offsets in the file
+        if (FILE *saveFile = fopen(savePath.c_str(), "r+b"))
         {
-            LOG_INFO("Writing save file to disk\n");
-            fwrite(save, sizeof(uint8_t), saveSize, saveFile);
+            LOG_INFO("Writing dirty save blocks to disk\n");
+            for (size_t i = 0, offset = 0; i < blocks.size(); i++)
+            {
+                uint32_t size = std::min<uint32_t>(SAVE_BLOCK, saveSize - blocks[i] * SAVE_BLOCK);
+                fseek(saveFile, blocks[i] * SAVE_BLOCK, SEEK_SET);
+                fwrite(&data[offset], sizeof(uint8_t), size, saveFile);
+                offset += size;
+            }
             fclose(saveFile);
-            saveDirty = false;
+            return;
         }
+#endif
     }
-    saveMutex.unlock();
+
+    // Rewrite the whole save file if the save was resized or can't be updated in place
+    // Blocks written after the dirty ones were taken are marked again, so copying them now is still safe
+    data.assign(save, save + saveSize);
+    if (FILE *saveFile = fopen(savePath.c_str(), "wb"))
+    {
+        LOG_INFO("Writing save file to disk\n");
+        fwrite(data.data(), sizeof(uint8_t), data.size(), saveFile);
+        fclose(saveFile);
+        saveResized = false;
+        return;
+    }
+
+    // Keep the changes for the next update if the file couldn't be opened
+    restoreDirty(dirty);
+}
+
+void Core::takeDirty(uint32_t *dirty)
+{
+    // Take and clear the dirty block bits
+    for (int i = 0; i < MAX_BLOCKS / 32; i++)
+        dirty[i] = dirtyBlocks[i].exchange(0, std::memory_order_acquire);
+}
+
+void Core::restoreDirty(const uint32_t *dirty)
+{
+    // Mark taken blocks dirty again, merging with any that were written since
+    for (int i = 0; i < MAX_BLOCKS / 32; i++)
+        dirtyBlocks[i].fetch_or(dirty[i], std::memory_order_release);
+}
+
+size_t Core::stateRamOffset()
+{
+    // Get the offset of RDRAM in a save state, which is the first thing after the header
+    State state(nullptr, 0);
+    writeHeader(state);
+    return state.offset;
+}
+
+size_t Core::stateSize()
+{
+    // Measure the size of a save state by writing one without a buffer
+    State state(nullptr, 0);
+    writeState(state);
+    return state.offset;
+}
+
+bool Core::saveState(uint8_t *data, size_t size)
+{
+    // Write a save state to the buffer if it's big enough
+    // The emulator should be stopped while this happens
+    if (size < stateSize()) return false;
+    State state(data, size);
+    writeState(state);
+    return true;
+}
+
+bool Core::loadState(const uint8_t *data, size_t size)
+{
+    // Check that the state matches this format and the current RAM configuration
+    // The emulator should be stopped while this happens
+    uint32_t magic, version;
+    if (size != stateSize()) return false;
+    memcpy(&magic, &data[0], sizeof(magic));
+    memcpy(&version, &data[4], sizeof(version));
+    if (magic != STATE_MAGIC || version != STATE_VERSION)
+    {
+        LOG_WARN("Save state has an unsupported format or version\n");
+        return false;
+    }
+
+    // Read the save state from the buffer
+    State state((uint8_t*)data, size);
+    readState(state);
+    return true;
+}
+
+void Core::writeHeader(State &state)
+{
+    // Write the save state header
+    state.write<uint32_t>(STATE_MAGIC);
+    state.write<uint32_t>(STATE_VERSION);
+
+    // Write the scheduler state, with the task queue padded to a fixed size
+    // Profiler samples are left out so states don't depend on whether profiling was enabled
+    uint32_t types[STATE_TASKS] = {}, cycles[STATE_TASKS] = {};
+    uint32_t count = 0;
+    for (size_t i = 0; i < tasks.size() && count < STATE_TASKS; i++)
+    {
+        if (tasks[i].type == PROFILE_SAMPLE) continue;
+        types[count] = tasks[i].type;
+        cycles[count++] = tasks[i].cycles;
+    }
+    state.write(cpuRunning);
+    state.write(rspRunning);
+    state.write(globalCycles);
+    state.write(cpuCycles);
+    state.write(rspCycles);
+    state.write(count);
+    state.write(types);
+    state.write(cycles);
+}
+
+void Core::writeState(State &state)
+{
+    // Let the RDP thread finish first, since it can still be writing to RDRAM
+    RDP::finishThread();
+
+    // Write the header and scheduler state, followed by the state of each component
+    writeHeader(state);
+    Memory::saveState(state);
+    CPU::saveState(state);
+    CPU_CP0::saveState(state);
+    CPU_CP1::saveState(state);
+    RSP::saveState(state);
+    RSP_CP0::saveState(state);
+    RSP_CP2::saveState(state);
+    RDP::saveState(state);
+    MI::saveState(state);
+    VI::saveState(state);
+    AI::saveState(state);
+    PI::saveState(state);
+    SI::saveState(state);
+    PIF::saveState(state);
+
+    // Write the save data so it stays in sync with the rest of the state
+    // It's padded to the largest save size, so the state size doesn't change if the save is resized
+    state.write(saveSize);
+    state.write(save, saveSize);
+    state.fill(0, MAX_SAVE_SIZE - saveSize);
+}
+
+void Core::readState(State &state)
+{
+    // Let the RDP thread finish first, so it doesn't write over the loaded RDRAM
+    RDP::finishThread();
+
+    // Skip the save state header, which was already checked
+    state.offset += sizeof(uint32_t) * 2;
+
+    // Read the scheduler state and rebuild the task queue
+    uint32_t types[STATE_TASKS], cycles[STATE_TASKS], count;
+    state.read(cpuRunning);
+    state.read(rspRunning);
+    state.read(globalCycles);
+    state.read(cpuCycles);
+    state.read(rspCycles);
+    state.read(count);
+    state.read(types);
+    state.read(cycles);
+    tasks.clear();
+    for (uint32_t i = 0; i < std::min<uint32_t>(count, STATE_TASKS); i++)
+    {
+        if (types[i] < MAX_TASKS && types[i] != PROFILE_SAMPLE)
+            tasks.push_back(Task((TaskType)types[i], cycles[i]));
+    }
+    sampling = false;
+
+    // Read the state of each component
+    Memory::loadState(state);
+    CPU::loadState(state);
+    CPU_CP0::loadState(state);
+    CPU_CP1::loadState(state);
+    RSP::loadState(state);
+    RSP_CP0::loadState(state);
+    RSP_CP2::loadState(state);
+    RDP::loadState(state);
+    MI::loadState(state);
+    VI::loadState(state);
+    AI::loadState(state);
+    PI::loadState(state);
+    SI::loadState(state);
+    PIF::loadState(state);
+
+    // Read the save data, only marking blocks that changed as dirty so they get written to disk
+    // This way, rolling back to a recent state doesn't rewrite the whole save file
+    // If the save was resized since the state was made, only the part both sizes share is loaded
+    uint32_t stateSaveSize;
+    state.read(stateSaveSize);
+    if (stateSaveSize != saveSize)
+        LOG_WARN("Save state has a different save size, so only part of the save will be loaded\n");
+    uint32_t shared = std::min(std::min(stateSaveSize, saveSize), (uint32_t)MAX_SAVE_SIZE);
+    for (uint32_t i = 0; i < shared; i += SAVE_BLOCK)
+    {
+        uint32_t size = std::min<uint32_t>(SAVE_BLOCK, shared - i);
+        const uint8_t *data = &state.data[state.offset + i];
+        if (memcmp(&save[i], data, size) == 0) continue;
+        memcpy(&save[i], data, size);
+        dirtyBlocks[i / SAVE_BLOCK / 32].fetch_or(1U << ((i / SAVE_BLOCK) & 31), std::memory_order_release);
+    }
+    state.offset += MAX_SAVE_SIZE;
 }
 
 void Core::resetCycles()
 {
     // Reset the cycle counts to prevent overflow
     CPU_CP0::resetCycles();
+    RSP_CP0::resetCycles();
     for (size_t i = 0; i < tasks.size(); i++)
         tasks[i].cycles -= globalCycles;
     cpuCycles -= std::min(globalCycles, cpuCycles);
@@ -325,14 +1239,42 @@ void Core::resetCycles()
     globalCycles -= globalCycles;
 
     // Schedule the next cycle reset
-    schedule(resetCycles, 0x7FFFFFFF);
+    schedule(RESET_CYCLES, 0x7FFFFFFF);
 }
 
-void Core::schedule(void (*function)(), uint32_t cycles)
+void Core::profileSample()
+{
+    // Sample the guest, and keep sampling until the profiler is disabled
+    Profiler::sample();
+    if (Settings::profiler)
+        schedule(PROFILE_SAMPLE, Profiler::interval());
+    else
+        sampling = false;
+}
+
+void Core::resetScheduler()
+{
+    // Empty the task queue and restart the cycle counters, keeping only the periodic cycle reset
+    tasks.clear();
+    globalCycles = 0;
+    cpuCycles = 0;
+    rspCycles = 0;
+    schedule(RESET_CYCLES, 0x7FFFFFFF);
+    sampling = false;
+}
+
+void Core::schedule(TaskType type, uint32_t cycles)
 {
     // Add a task to the scheduler, sorted by least to most cycles until execution
     // Cycles run at 93.75 * 2 MHz
-    Task task(function, globalCycles + cycles);
+    Task task(type, globalCycles + cycles);
     auto it = std::upper_bound(tasks.cbegin(), tasks.cend(), task);
     tasks.insert(it, task);
 }
+
+void Core::unschedule(TaskType type)
+{
+    // Remove all pending tasks of a type from the scheduler, keeping the rest in order
+    tasks.erase(std::remove_if(tasks.begin(), tasks.end(),
+        [type](const Task &task) { return task.type == type; }), tasks.end());
+}
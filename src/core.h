@@ -20,9 +20,45 @@
 #ifndef CORE_H
 #define CORE_H
 
+#include <cstddef>
 #include <cstdint>
 #include <string>
 
+struct State;
+
+struct CoreStats
+{
+    uint64_t frames;
+    uint64_t events;
+    uint64_t cpuOpcodes;
+    uint64_t rspOpcodes;
+    uint64_t rdpCommands;
+    uint64_t rdpPixels;
+    uint64_t dmaBytes[3];
+    uint64_t audioUnderruns;
+
+    // Host time in nanoseconds, only accumulated while performance stats are enabled
+    uint64_t cpuTime;
+    uint64_t rspTime;
+    uint64_t rdpTime;
+    uint64_t viTime;
+};
+
+enum TaskType
+{
+    RESET_CYCLES = 0,
+    AI_CREATE_BUFFER,
+    AI_PROCESS_BUFFER,
+    VI_DRAW_FRAME,
+    CP0_UPDATE_COUNT,
+    CP0_INTERRUPT,
+    PI_FINISH_DMA,
+    SI_FINISH_DMA,
+    SP_FINISH_DMA,
+    PROFILE_SAMPLE,
+    MAX_TASKS
+};
+
 namespace Core
 {
     extern bool running;
@@ -30,6 +66,12 @@ namespace Core
     extern bool rspRunning;
     extern uint32_t globalCycles;
     extern int fps;
+    extern float startupTime;
+
+    extern bool skipVideo;
+    extern bool skipAudio;
+    extern bool skipRdp;
+    extern bool skipFrame;
 
     extern uint8_t *rom;
     extern uint8_t *save;
@@ -37,14 +79,31 @@ namespace Core
     extern uint32_t saveSize;
     extern std::string savePath;
 
-    bool bootRom(const std::string &path);
+    void loadRom(const uint8_t *data, uint32_t size, bool persistent);
+    void unloadRom();
+    bool bootRom(const std::string &path, bool resume = false);
     void resizeSave(uint32_t newSize);
+    void unloadSave();
     void start();
+    void pause();
     void stop();
+    void shutdown();
+    void runFrame();
+    CoreStats getStats();
+    uint64_t hostTime();
+    void framePresented();
+
+    size_t stateRamOffset();
+    size_t stateSize();
+    bool saveState(uint8_t *data, size_t size);
+    bool loadState(const uint8_t *data, size_t size);
 
+    void updateFrameskip(bool behind);
     void countFrame();
     void writeSave(uint32_t address, uint8_t value);
-    void schedule(void (*function)(), uint32_t cycles);
+    void resetScheduler();
+    void schedule(TaskType type, uint32_t cycles);
+    void unschedule(TaskType type);
 }
 
 #endif // CORE_H
@@ -25,6 +25,7 @@
 #include "cpu_cp1.h"
 #include "log.h"
 #include "memory.h"
+#include "state.h"
 
 // _mul128 / _umul128
 #ifdef _MSC_VER
@@ -45,6 +46,9 @@ namespace CPU
     extern void (*immInstrs[])(uint32_t);
     extern void (*regInstrs[])(uint32_t);
     extern void (*extInstrs[])(uint32_t);
+    extern const char *immNames[];
+    extern const char *regNames[];
+    extern const char *extNames[];
 
     void j(uint32_t opcode);
     void jal(uint32_t opcode);
@@ -199,6 +203,69 @@ void (*CPU::extInstrs[0x20])(uint32_t) =
     unk,    unk,    unk,     unk,     unk, unk, unk, unk  // 0x18-0x1F
 };
 
+// Instruction names for profiling, laid out like the lookup tables
+const char *CPU::immNames[0x40] =
+{
+    "special", "regimm", "j",    "jal",   "beq",  "bne",  "blez",  "bgtz",  // 0x00-0x07
+    "addi",    "addiu",  "slti", "sltiu", "andi", "ori",  "xori",  "lui",   // 0x08-0x0F
+    "cop0",    "cop1",   "unk",  "unk",   "beql", "bnel", "blezl", "bgtzl", // 0x10-0x17
+    "daddi",   "daddiu", "ldl",  "ldr",   "unk",  "unk",  "unk",   "unk",   // 0x18-0x1F
+    "lb",      "lh",     "lwl",  "lw",    "lbu",  "lhu",  "lwr",   "lwu",   // 0x20-0x27
+    "sb",      "sh",     "swl",  "sw",    "sdl",  "sdr",  "swr",   "cache", // 0x28-0x2F
+    "unk",     "lwc1",   "unk",  "unk",   "unk",  "ldc1", "unk",   "ld",    // 0x30-0x37
+    "unk",     "swc1",   "unk",  "unk",   "unk",  "sdc1", "unk",   "sd"     // 0x38-0x3F
+};
+
+const char *CPU::regNames[0x40] =
+{
+    "sll",  "unk",   "srl",  "sra",  "sllv",    "unk",    "srlv",   "srav",  // 0x00-0x07
+    "jr",   "jalr",  "unk",  "unk",  "syscall", "break",  "unk",    "unk",   // 0x08-0x0F
+    "mfhi", "mthi",  "mflo", "mtlo", "dsllv",   "unk",    "dsrlv",  "dsrav", // 0x10-0x17
+    "mult", "multu", "div",  "divu", "dmult",   "dmultu", "ddiv",   "ddivu", // 0x18-0x1F
+    "add",  "addu",  "sub",  "subu", "and",     "or",     "xor",    "nor",   // 0x20-0x27
+    "unk",  "unk",   "slt",  "sltu", "dadd",    "daddu",  "dsub",   "dsubu", // 0x28-0x2F
+    "unk",  "unk",   "unk",  "unk",  "unk",     "unk",    "unk",    "unk",   // 0x30-0x37
+    "dsll", "unk",   "dsrl", "dsra", "dsll32",  "unk",    "dsrl32", "dsra32" // 0x38-0x3F
+};
+
+const char *CPU::extNames[0x20] =
+{
+    "bltz",   "bgez",   "bltzl",   "bgezl",   "unk", "unk", "unk", "unk", // 0x00-0x07
+    "unk",    "unk",    "unk",     "unk",     "unk", "unk", "unk", "unk", // 0x08-0x0F
+    "bltzal", "bgezal", "bltzall", "bgezall", "unk", "unk", "unk", "unk", // 0x10-0x17
+    "unk",    "unk",    "unk",     "unk",     "unk", "unk", "unk", "unk"  // 0x18-0x1F
+};
+
+const char *CPU::opcodeName(uint32_t opcode)
+{
+    // Look up the name of an instruction the same way it would be executed
+    switch (opcode >> 26)
+    {
+        default: return immNames[opcode >> 26];
+        case 0:  return regNames[opcode & 0x3F];
+        case 1:  return extNames[(opcode >> 16) & 0x1F];
+    }
+}
+
+uint32_t CPU::nextAddress()
+{
+    // Get the address of the next opcode to run, which is a delay slot if a jump was just taken
+    return (delaySlot != -1) ? delaySlot : programCounter;
+}
+
+bool CPU::isBranch(uint32_t opcode)
+{
+    // Check if an instruction is a jump or branch, which is followed by a delay slot
+    switch (opcode >> 26)
+    {
+        case 0x00: return (opcode & 0x3E) == 0x08; // jr, jalr
+        case 0x01: case 0x02: case 0x03: case 0x04: case 0x05: case 0x06: case 0x07:
+        case 0x14: case 0x15: case 0x16: case 0x17: return true;
+        case 0x11: return ((opcode >> 21) & 0x1F) == 0x08; // bc1
+        default: return false;
+    }
+}
+
 void CPU::reset()
 {
     // Map the writable registers so that writes to r0 are redirected
@@ -214,6 +281,28 @@ void CPU::reset()
     delaySlot = -1;
 }
 
+void CPU::saveState(State &state)
+{
+    // Save the CPU registers and pipeline state
+    state.write(registersR);
+    state.write(hi);
+    state.write(lo);
+    state.write(programCounter);
+    state.write(nextOpcode);
+    state.write(delaySlot);
+}
+
+void CPU::loadState(State &state)
+{
+    // Load the CPU registers and pipeline state
+    state.read(registersR);
+    state.read(hi);
+    state.read(lo);
+    state.read(programCounter);
+    state.read(nextOpcode);
+    state.read(delaySlot);
+}
+
 void CPU::runOpcode()
 {
     // Move an opcode through the pipeline
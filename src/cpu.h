@@ -22,6 +22,8 @@
 
 #include <cstdint>
 
+struct State;
+
 namespace CPU
 {
     extern uint64_t *registersW[32];
@@ -30,7 +32,13 @@ namespace CPU
     extern uint32_t delaySlot;
 
     void reset();
+    void saveState(State &state);
+    void loadState(State &state);
     void runOpcode();
+
+    uint32_t nextAddress();
+    const char *opcodeName(uint32_t opcode);
+    bool isBranch(uint32_t opcode);
 }
 
 #endif // CPU_H
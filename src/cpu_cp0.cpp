@@ -24,6 +24,7 @@
 #include "log.h"
 #include "memory.h"
 #include "mi.h"
+#include "state.h"
 
 namespace CPU_CP0
 {
@@ -46,8 +47,6 @@ namespace CPU_CP0
     uint32_t endCycles;
 
     void scheduleCount();
-    void updateCount();
-    void interrupt();
 
     void tlbr(uint32_t opcode);
     void tlbwi(uint32_t opcode);
@@ -90,6 +89,48 @@ void CPU_CP0::reset()
     scheduleCount();
 }
 
+void CPU_CP0::saveState(State &state)
+{
+    // Save the CPU CP0 registers and count timing
+    state.write(_index);
+    state.write(entryLo0);
+    state.write(entryLo1);
+    state.write(context);
+    state.write(pageMask);
+    state.write(badVAddr);
+    state.write(count);
+    state.write(entryHi);
+    state.write(compare);
+    state.write(status);
+    state.write(cause);
+    state.write(epc);
+    state.write(errorEpc);
+    state.write(irqPending);
+    state.write(startCycles);
+    state.write(endCycles);
+}
+
+void CPU_CP0::loadState(State &state)
+{
+    // Load the CPU CP0 registers and count timing
+    state.read(_index);
+    state.read(entryLo0);
+    state.read(entryLo1);
+    state.read(context);
+    state.read(pageMask);
+    state.read(badVAddr);
+    state.read(count);
+    state.read(entryHi);
+    state.read(compare);
+    state.read(status);
+    state.read(cause);
+    state.read(epc);
+    state.read(errorEpc);
+    state.read(irqPending);
+    state.read(startCycles);
+    state.read(endCycles);
+}
+
 int32_t CPU_CP0::read(int index)
 {
     // Read from a CPU CP0 register if one exists at the given index
@@ -256,7 +297,7 @@ void CPU_CP0::scheduleCount()
     // This helps prevent overloading the scheduler when registers are used excessively
     if (endCycles > cycles)
     {
-        Core::schedule(updateCount, cycles - startCycles);
+        Core::schedule(CP0_UPDATE_COUNT, cycles - startCycles);
         endCycles = cycles;
     }
 }
@@ -287,7 +328,7 @@ void CPU_CP0::checkInterrupts()
     // Schedule an interrupt if able and an enabled bit is set
     if (((status & 0x3) == 0x1) && (status & cause & 0xFF00) && !irqPending)
     {
-        Core::schedule(interrupt, 2); // 1 CPU cycle
+        Core::schedule(CP0_INTERRUPT, 2); // 1 CPU cycle
         irqPending = true;
     }
 }
@@ -22,15 +22,21 @@
 
 #include <cstdint>
 
+struct State;
+
 namespace CPU_CP0
 {
     extern void (*cp0Instrs[])(uint32_t);
 
     void reset();
+    void saveState(State &state);
+    void loadState(State &state);
     int32_t read(int index);
     void write(int index, int32_t value);
 
     void resetCycles();
+    void updateCount();
+    void interrupt();
     void checkInterrupts();
     void exception(uint8_t type);
     void setTlbAddress(uint32_t address);
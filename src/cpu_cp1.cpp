@@ -24,6 +24,7 @@
 #include "cpu_cp1.h"
 #include "cpu.h"
 #include "log.h"
+#include "state.h"
 
 namespace CPU_CP1
 {
@@ -172,6 +173,22 @@ void CPU_CP1::reset()
     status = 0;
 }
 
+void CPU_CP1::saveState(State &state)
+{
+    // Save the CPU CP1 registers and mode
+    state.write(fullMode);
+    state.write(registers);
+    state.write(status);
+}
+
+void CPU_CP1::loadState(State &state)
+{
+    // Load the CPU CP1 registers and mode
+    state.read(fullMode);
+    state.read(registers);
+    state.read(status);
+}
+
 uint64_t CPU_CP1::read(CP1Type type, int index)
 {
     switch (type)
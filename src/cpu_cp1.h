@@ -22,6 +22,8 @@
 
 #include <cstdint>
 
+struct State;
+
 enum CP1Type
 {
     CP1_32BIT = 0,
@@ -37,6 +39,8 @@ namespace CPU_CP1
     extern void (*lwdInstrs[])(uint32_t);
 
     void reset();
+    void saveState(State &state);
+    void loadState(State &state);
     uint64_t read(CP1Type type, int index);
     void write(CP1Type type, int index, uint64_t value);
     void setRegMode(bool full);
@@ -42,6 +42,7 @@ enum InputEvent
     REMAP_SRIGHT,
     REMAP_SMOD,
     REMAP_FULLSCREEN,
+    REMAP_REWIND,
     CLEAR_MAP,
     UPDATE_JOY
 };
@@ -67,6 +68,7 @@ EVT_BUTTON(REMAP_SLEFT, InputDialog::remapSLeft)
 EVT_BUTTON(REMAP_SRIGHT, InputDialog::remapSRight)
 EVT_BUTTON(REMAP_SMOD, InputDialog::remapSMod)
 EVT_BUTTON(REMAP_FULLSCREEN, InputDialog::remapFullScreen)
+EVT_BUTTON(REMAP_REWIND, InputDialog::remapRewind)
 EVT_BUTTON(CLEAR_MAP, InputDialog::clearMap)
 EVT_TIMER(UPDATE_JOY, InputDialog::updateJoystick)
 EVT_BUTTON(wxID_OK, InputDialog::confirm)
@@ -213,7 +215,7 @@ InputDialog::InputDialog(wxJoystick *joystick):
         "L Button", "R Button",
         "C-Pad Up", "C-Pad Down", "C-Pad Left", "C-Pad Right",
         "Stick Up", "Stick Down", "Stick Left", "Stick Right",
-        "Stick Mod", "Full Screen"
+        "Stick Mod", "Full Screen", "Rewind"
     };
 
     // Set up individual buttons for each binding
@@ -257,6 +259,7 @@ InputDialog::InputDialog(wxJoystick *joystick):
     column4->Add(keySizers[6], 1, wxEXPAND | wxALL, scale / 8);
     column4->Add(keySizers[7], 1, wxEXPAND | wxALL, scale / 8);
     column4->Add(keySizers[19], 1, wxEXPAND | wxALL, scale / 8);
+    column4->Add(keySizers[20], 1, wxEXPAND | wxALL, scale / 8);
 
     // Combine the button tab contents and add a final border around it
     wxBoxSizer *buttonSizer = new wxBoxSizer(wxHORIZONTAL);
@@ -341,6 +344,7 @@ REMAP_FUNC(remapSLeft, 16)
 REMAP_FUNC(remapSRight, 17)
 REMAP_FUNC(remapSMod, 18)
 REMAP_FUNC(remapFullScreen, 19)
+REMAP_FUNC(remapRewind, 20)
 
 void InputDialog::clearMap(wxCommandEvent &event)
 {
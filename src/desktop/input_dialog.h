@@ -61,6 +61,7 @@ class InputDialog: public wxDialog
         void remapSRight(wxCommandEvent &event);
         void remapSMod(wxCommandEvent &event);
         void remapFullScreen(wxCommandEvent &event);
+        void remapRewind(wxCommandEvent &event);
 
         void clearMap(wxCommandEvent &event);
         void updateJoystick(wxTimerEvent &event);
@@ -41,7 +41,8 @@ int ryApp::keyBinds[] =
     'Q', 'P', // L, R
     '8', 'I', 'U', 'O', // C-buttons
     'W', 'S', 'A', 'D', WXK_SHIFT, // Joystick
-    WXK_ESCAPE // Full screen
+    WXK_ESCAPE, // Full screen
+    WXK_BACK // Rewind
 };
 
 bool ryApp::OnInit()
@@ -54,7 +55,7 @@ bool ryApp::OnInit()
         "keyL", "keyR",
         "keyCUp", "keyCDown", "keyCLeft", "keyCRight",
         "keySUp", "keySDown", "keySLeft", "keySRight",
-        "keySMod", "keyFullScreen"
+        "keySMod", "keyFullScreen", "keyRewind"
     };
 
     // Register the input binding settings
@@ -118,6 +119,6 @@ int ryApp::audioCallback(const void *in, void *out, unsigned long count,
     const PaStreamCallbackTimeInfo *info, PaStreamCallbackFlags flags, void *data)
 {
     // Get samples from the audio interface
-    AI::fillBuffer((uint32_t*)out);
+    AI::fillBuffer((uint32_t*)out, count);
     return paContinue;
 }
@@ -169,6 +169,10 @@ void ryCanvas::pressKey(wxKeyEvent &event)
         frame->ShowFullScreen(fullScreen = !fullScreen);
         sizeReset = 2;
     }
+
+    // Start rewinding if the hotkey was pressed
+    if (event.GetKeyCode() == ryApp::keyBinds[20])
+        frame->pressKey(20);
 }
 
 void ryCanvas::releaseKey(wxKeyEvent &event)
@@ -22,7 +22,9 @@
 #include "input_dialog.h"
 #include "save_dialog.h"
 #include "../core.h"
+#include "../movie.h"
 #include "../pif.h"
+#include "../rewind.h"
 #include "../settings.h"
 
 enum FrameEvent
@@ -33,11 +35,27 @@ enum FrameEvent
     PAUSE,
     RESTART,
     STOP,
+    RECORD_MOVIE,
+    PLAY_MOVIE,
     INPUT_BINDINGS,
     FPS_LIMITER,
     EXPANSION_PAK,
+    DMA_TIMING,
+    MMAP_SAVES,
+    INSTANT_RESUME,
+    REWIND,
+    PERF_STATS,
+    TRACE,
+    PROFILER,
     THREADED_RDP,
     TEX_FILTER,
+    FRAMESKIP_OFF,
+    FRAMESKIP_AUTO,
+    FRAMESKIP_FIXED,
+    DYNAMIC_RATE,
+    AUDIO_LINEAR,
+    AUDIO_CUBIC,
+    AUDIO_SINC,
     UPDATE_JOY
 };
 
@@ -48,11 +66,27 @@ EVT_MENU(QUIT, ryFrame::quit)
 EVT_MENU(PAUSE, ryFrame::pause)
 EVT_MENU(RESTART, ryFrame::restart)
 EVT_MENU(STOP, ryFrame::stop)
+EVT_MENU(RECORD_MOVIE, ryFrame::recordMovie)
+EVT_MENU(PLAY_MOVIE, ryFrame::playMovie)
 EVT_MENU(INPUT_BINDINGS, ryFrame::inputSettings)
 EVT_MENU(FPS_LIMITER, ryFrame::toggleFpsLimit)
 EVT_MENU(EXPANSION_PAK, ryFrame::toggleExpanPak)
+EVT_MENU(DMA_TIMING, ryFrame::toggleDmaTiming)
+EVT_MENU(MMAP_SAVES, ryFrame::toggleMmapSaves)
+EVT_MENU(INSTANT_RESUME, ryFrame::toggleResume)
+EVT_MENU(REWIND, ryFrame::toggleRewind)
+EVT_MENU(PERF_STATS, ryFrame::togglePerfStats)
+EVT_MENU(TRACE, ryFrame::toggleTrace)
+EVT_MENU(PROFILER, ryFrame::toggleProfiler)
 EVT_MENU(THREADED_RDP, ryFrame::toggleThreadRdp)
 EVT_MENU(TEX_FILTER, ryFrame::toggleTexFilter)
+EVT_MENU(FRAMESKIP_OFF, ryFrame::setFrameskip)
+EVT_MENU(FRAMESKIP_AUTO, ryFrame::setFrameskip)
+EVT_MENU(FRAMESKIP_FIXED, ryFrame::setFrameskip)
+EVT_MENU(DYNAMIC_RATE, ryFrame::toggleDynRate)
+EVT_MENU(AUDIO_LINEAR, ryFrame::setAudioQuality)
+EVT_MENU(AUDIO_CUBIC, ryFrame::setAudioQuality)
+EVT_MENU(AUDIO_SINC, ryFrame::setAudioQuality)
 EVT_TIMER(UPDATE_JOY, ryFrame::updateJoystick)
 EVT_DROP_FILES(ryFrame::dropFiles)
 EVT_CLOSE(ryFrame::close)
@@ -72,6 +106,9 @@ ryFrame::ryFrame(std::string path): wxFrame(nullptr, wxID_ANY, "rokuyon")
     systemMenu->Append(PAUSE, "&Resume");
     systemMenu->Append(RESTART, "&Restart");
     systemMenu->Append(STOP, "&Stop");
+    systemMenu->AppendSeparator();
+    systemMenu->Append(RECORD_MOVIE, "Record &Input Movie");
+    systemMenu->Append(PLAY_MOVIE, "Play Input &Movie");
     updateMenu();
 
     // Set up the settings menu
@@ -80,15 +117,48 @@ ryFrame::ryFrame(std::string path): wxFrame(nullptr, wxID_ANY, "rokuyon")
     settingsMenu->AppendSeparator();
     settingsMenu->AppendCheckItem(FPS_LIMITER, "&FPS Limiter");
     settingsMenu->AppendCheckItem(EXPANSION_PAK, "&Expansion Pak");
+    settingsMenu->AppendCheckItem(DMA_TIMING, "&DMA Timing");
+    settingsMenu->AppendCheckItem(MMAP_SAVES, "&Memory-Mapped Saves");
+    settingsMenu->AppendCheckItem(INSTANT_RESUME, "&Instant Resume");
+    settingsMenu->AppendCheckItem(REWIND, "&Rewind");
+    settingsMenu->AppendCheckItem(PERF_STATS, "&Performance Stats");
+    settingsMenu->AppendCheckItem(TRACE, "Record T&race");
+    settingsMenu->AppendCheckItem(PROFILER, "Profile &Guest Code");
     settingsMenu->AppendSeparator();
     settingsMenu->AppendCheckItem(THREADED_RDP, "&Threaded RDP");
     settingsMenu->AppendCheckItem(TEX_FILTER, "&Texture Filter");
 
+    // Set up the frameskip submenu
+    wxMenu *frameskipMenu = new wxMenu();
+    frameskipMenu->AppendRadioItem(FRAMESKIP_OFF, "&Off");
+    frameskipMenu->AppendRadioItem(FRAMESKIP_AUTO, "&Automatic");
+    frameskipMenu->AppendRadioItem(FRAMESKIP_FIXED, "&Fixed Interval");
+    settingsMenu->AppendSubMenu(frameskipMenu, "&Frameskip");
+
+    // Set up the audio resampling submenu
+    wxMenu *audioMenu = new wxMenu();
+    audioMenu->AppendRadioItem(AUDIO_LINEAR, "&Linear");
+    audioMenu->AppendRadioItem(AUDIO_CUBIC, "&Cubic");
+    audioMenu->AppendRadioItem(AUDIO_SINC, "&Sinc");
+    settingsMenu->AppendSeparator();
+    settingsMenu->AppendCheckItem(DYNAMIC_RATE, "&Dynamic Rate Control");
+    settingsMenu->AppendSubMenu(audioMenu, "&Audio Resampling");
+
     // Set the initial checkbox states
     settingsMenu->Check(FPS_LIMITER, Settings::fpsLimiter);
     settingsMenu->Check(EXPANSION_PAK, Settings::expansionPak);
+    settingsMenu->Check(DMA_TIMING, Settings::dmaTiming);
+    settingsMenu->Check(MMAP_SAVES, Settings::mmapSaves);
+    settingsMenu->Check(INSTANT_RESUME, Settings::instantResume);
+    settingsMenu->Check(REWIND, Settings::rewind);
+    settingsMenu->Check(PERF_STATS, Settings::perfStats);
+    settingsMenu->Check(TRACE, Settings::trace);
+    settingsMenu->Check(PROFILER, Settings::profiler);
     settingsMenu->Check(THREADED_RDP, Settings::threadedRdp);
     settingsMenu->Check(TEX_FILTER, Settings::texFilter);
+    settingsMenu->Check(DYNAMIC_RATE, Settings::dynamicRate);
+    frameskipMenu->Check(FRAMESKIP_OFF + Settings::frameskip, true);
+    audioMenu->Check(AUDIO_LINEAR + Settings::audioQuality, true);
 
     // Set up the menu bar
     wxMenuBar *menuBar = new wxMenuBar();
@@ -133,16 +203,16 @@ ryFrame::ryFrame(std::string path): wxFrame(nullptr, wxID_ANY, "rokuyon")
 
     // Boot a ROM right away if a filename was given through the command line
     if (path != "")
-        bootRom(path);
+        bootRom(path, true);
 }
 
-void ryFrame::bootRom(std::string path)
+void ryFrame::bootRom(std::string path, bool resume)
 {
     // Remember the path so the ROM can be restarted
     lastPath = path;
 
     // Try to boot the specified ROM, and display an error if failed
-    if (!Core::bootRom(path))
+    if (!Core::bootRom(path, resume))
     {
         wxMessageDialog(this, "Make sure the ROM file is accessible and try again.",
             "Error Loading ROM", wxICON_NONE).ShowModal();
@@ -163,6 +233,8 @@ void ryFrame::updateMenu()
         systemMenu->Enable(PAUSE, true);
         systemMenu->Enable(RESTART, true);
         systemMenu->Enable(STOP, true);
+        systemMenu->Enable(RECORD_MOVIE, true);
+        systemMenu->Enable(PLAY_MOVIE, true);
         fileMenu->Enable(CHANGE_SAVE, true);
     }
     else
@@ -174,6 +246,8 @@ void ryFrame::updateMenu()
             systemMenu->Enable(PAUSE, false);
             systemMenu->Enable(RESTART, false);
             systemMenu->Enable(STOP, false);
+            systemMenu->Enable(RECORD_MOVIE, false);
+            systemMenu->Enable(PLAY_MOVIE, false);
             fileMenu->Enable(CHANGE_SAVE, false);
         }
     }
@@ -187,6 +261,36 @@ void ryFrame::Refresh()
     wxString label = "rokuyon";
     if (Core::running)
         label += wxString::Format(" - %d FPS", Core::fps);
+
+    // Show how much rewind history there is and what it costs
+    if (Core::running && Settings::rewind)
+    {
+        RewindStats stats = Rewind::getStats();
+        label += wxString::Format(" - Rewind %.0fs (%.0f KB/s, %.0f us/frame)",
+            stats.seconds, stats.bytesPerSecond / 1024, stats.captureTime);
+    }
+
+    // Show where host time goes per frame, averaged over the last second
+    if (Core::running && Settings::perfStats)
+    {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (now - lastStatsTime >= std::chrono::seconds(1))
+        {
+            CoreStats stats = Core::getStats();
+            double frames = (stats.frames > lastStats.frames) ? (stats.frames - lastStats.frames) : 1;
+            double seconds = std::chrono::duration<double>(now - lastStatsTime).count();
+            statsLabel = wxString::Format(" - CPU %.1fms (%.0f MIPS), RSP %.1fms, RDP %.1fms (%.1fM px), VI %.1fms",
+                (stats.cpuTime - lastStats.cpuTime) / frames / 1000000,
+                (stats.cpuOpcodes - lastStats.cpuOpcodes) / seconds / 1000000,
+                (stats.rspTime - lastStats.rspTime) / frames / 1000000,
+                (stats.rdpTime - lastStats.rdpTime) / frames / 1000000,
+                (stats.rdpPixels - lastStats.rdpPixels) / seconds / 1000000,
+                (stats.viTime - lastStats.viTime) / frames / 1000000);
+            lastStats = stats;
+            lastStatsTime = now;
+        }
+        label += statsLabel;
+    }
     SetLabel(label);
 }
 
@@ -208,6 +312,11 @@ void ryFrame::pressKey(int key)
         stickPressed[key - 14] = true;
         updateKeyStick();
     }
+    else if (key == 20)
+    {
+        // Start rewinding
+        Rewind::setActive(true);
+    }
 }
 
 void ryFrame::releaseKey(int key)
@@ -228,6 +337,11 @@ void ryFrame::releaseKey(int key)
         stickPressed[key - 14] = false;
         updateKeyStick();
     }
+    else if (key == 20)
+    {
+        // Stop rewinding
+        Rewind::setActive(false);
+    }
 }
 
 void ryFrame::updateKeyStick()
@@ -266,7 +380,7 @@ void ryFrame::loadRom(wxCommandEvent &event)
 
     // Boot a ROM if a file was selected
     if (romSelect.ShowModal() != wxID_CANCEL)
-        bootRom((const char*)romSelect.GetPath().mb_str(wxConvUTF8));
+        bootRom((const char*)romSelect.GetPath().mb_str(wxConvUTF8), true);
 }
 
 void ryFrame::changeSave(wxCommandEvent &event)
@@ -286,7 +400,7 @@ void ryFrame::pause(wxCommandEvent &event)
 {
     // Temporarily stop or start the emulator
     if ((paused = !paused))
-        Core::stop();
+        Core::pause();
     else
         Core::start();
     updateMenu();
@@ -294,18 +408,60 @@ void ryFrame::pause(wxCommandEvent &event)
 
 void ryFrame::restart(wxCommandEvent &event)
 {
-    // Boot the most recently loaded ROM again
-    ryFrame::bootRom(lastPath);
+    // Boot the most recently loaded ROM again, from scratch
+    ryFrame::bootRom(lastPath, false);
 }
 
 void ryFrame::stop(wxCommandEvent &event)
 {
-    // Stop the emulator and reset the system menu
+    // Stop the emulator and reset the system menu, finishing any input movie
     Core::stop();
+    Movie::stop();
     paused = false;
     updateMenu();
 }
 
+void ryFrame::recordMovie(wxCommandEvent &event)
+{
+    // Show the file browser
+    wxFileDialog movieSelect(this, "Record Input Movie", "", "", "Input movie files (*.movie)|*.movie", wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+    if (movieSelect.ShowModal() == wxID_CANCEL)
+        return;
+
+    // Start recording and restart the ROM from scratch, so the movie can be replayed from boot
+    // The movie is written when emulation is stopped
+    Core::stop();
+    if (!Movie::record((const char*)movieSelect.GetPath().mb_str(wxConvUTF8)))
+    {
+        wxMessageDialog(this, "Make sure the movie file is writable and try again.",
+            "Error Recording Movie", wxICON_NONE).ShowModal();
+        paused = false;
+        updateMenu();
+        return;
+    }
+    bootRom(lastPath, false);
+}
+
+void ryFrame::playMovie(wxCommandEvent &event)
+{
+    // Show the file browser
+    wxFileDialog movieSelect(this, "Play Input Movie", "", "", "Input movie files (*.movie)|*.movie", wxFD_OPEN | wxFD_FILE_MUST_EXIST);
+    if (movieSelect.ShowModal() == wxID_CANCEL)
+        return;
+
+    // Start playback and restart the ROM from scratch, since movies are recorded from boot
+    Core::stop();
+    if (!Movie::play((const char*)movieSelect.GetPath().mb_str(wxConvUTF8)))
+    {
+        wxMessageDialog(this, "Make sure the movie file is accessible and try again.",
+            "Error Playing Movie", wxICON_NONE).ShowModal();
+        paused = false;
+        updateMenu();
+        return;
+    }
+    bootRom(lastPath, false);
+}
+
 void ryFrame::inputSettings(wxCommandEvent &event)
 {
     // Pause joystick updates and show the input settings dialog
@@ -329,6 +485,55 @@ void ryFrame::toggleExpanPak(wxCommandEvent &event)
     Settings::save();
 }
 
+void ryFrame::toggleDmaTiming(wxCommandEvent &event)
+{
+    // Toggle the DMA timing setting
+    Settings::dmaTiming = !Settings::dmaTiming;
+    Settings::save();
+}
+
+void ryFrame::toggleMmapSaves(wxCommandEvent &event)
+{
+    // Toggle the memory-mapped saves setting
+    Settings::mmapSaves = !Settings::mmapSaves;
+    Settings::save();
+}
+
+void ryFrame::toggleResume(wxCommandEvent &event)
+{
+    // Toggle the instant resume setting
+    Settings::instantResume = !Settings::instantResume;
+    Settings::save();
+}
+
+void ryFrame::toggleRewind(wxCommandEvent &event)
+{
+    // Toggle the rewind setting
+    Settings::rewind = !Settings::rewind;
+    Settings::save();
+}
+
+void ryFrame::togglePerfStats(wxCommandEvent &event)
+{
+    // Toggle the performance stats setting
+    Settings::perfStats = !Settings::perfStats;
+    Settings::save();
+}
+
+void ryFrame::toggleTrace(wxCommandEvent &event)
+{
+    // Toggle the trace setting; the trace is written next to the save when emulation stops
+    Settings::trace = !Settings::trace;
+    Settings::save();
+}
+
+void ryFrame::toggleProfiler(wxCommandEvent &event)
+{
+    // Toggle the profiler setting; the profile is written next to the save when emulation stops
+    Settings::profiler = !Settings::profiler;
+    Settings::save();
+}
+
 void ryFrame::toggleThreadRdp(wxCommandEvent &event)
 {
     // Toggle the threaded RDP setting
@@ -343,6 +548,27 @@ void ryFrame::toggleTexFilter(wxCommandEvent &event)
     Settings::save();
 }
 
+void ryFrame::toggleDynRate(wxCommandEvent &event)
+{
+    // Toggle the dynamic rate control setting
+    Settings::dynamicRate = !Settings::dynamicRate;
+    Settings::save();
+}
+
+void ryFrame::setFrameskip(wxCommandEvent &event)
+{
+    // Set the frameskip mode based on the selected item
+    Settings::frameskip = event.GetId() - FRAMESKIP_OFF;
+    Settings::save();
+}
+
+void ryFrame::setAudioQuality(wxCommandEvent &event)
+{
+    // Set the audio resampling quality based on the selected item
+    Settings::audioQuality = event.GetId() - AUDIO_LINEAR;
+    Settings::save();
+}
+
 void ryFrame::updateJoystick(wxTimerEvent &event)
 {
     int stickX = 0;
@@ -456,14 +682,15 @@ void ryFrame::dropFiles(wxDropFilesEvent &event)
     {
         wxString path = event.GetFiles()[0];
         if (wxFileExists(path))
-            bootRom((const char*)path.mb_str(wxConvUTF8));
+            bootRom((const char*)path.mb_str(wxConvUTF8), true);
     }
 }
 
 void ryFrame::close(wxCloseEvent &event)
 {
-    // Stop emulation before exiting
-    Core::stop();
+    // Stop emulation and end its threads before exiting
+    Core::shutdown();
+    Movie::stop();
     canvas->finish();
     event.Skip(true);
 }
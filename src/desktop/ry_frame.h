@@ -20,10 +20,13 @@
 #ifndef RY_FRAME_H
 #define RY_FRAME_H
 
+#include <chrono>
 #include <vector>
 #include <wx/wx.h>
 #include <wx/joystick.h>
 
+#include "../core.h"
+
 #define MIN_SIZE wxSize(480, 360)
 
 class ryCanvas;
@@ -51,7 +54,11 @@ class ryFrame: public wxFrame
         std::vector<int> axisBases;
         bool stickPressed[5] = {};
 
-        void bootRom(std::string path);
+        CoreStats lastStats = {};
+        std::chrono::steady_clock::time_point lastStatsTime;
+        wxString statsLabel;
+
+        void bootRom(std::string path, bool resume);
         void updateMenu();
         void updateKeyStick();
 
@@ -61,11 +68,23 @@ class ryFrame: public wxFrame
         void pause(wxCommandEvent &event);
         void restart(wxCommandEvent &event);
         void stop(wxCommandEvent &event);
+        void recordMovie(wxCommandEvent &event);
+        void playMovie(wxCommandEvent &event);
         void inputSettings(wxCommandEvent &event);
         void toggleFpsLimit(wxCommandEvent &event);
         void toggleExpanPak(wxCommandEvent &event);
+        void toggleDmaTiming(wxCommandEvent &event);
+        void toggleMmapSaves(wxCommandEvent &event);
+        void toggleResume(wxCommandEvent &event);
+        void toggleRewind(wxCommandEvent &event);
+        void togglePerfStats(wxCommandEvent &event);
+        void toggleTrace(wxCommandEvent &event);
+        void toggleProfiler(wxCommandEvent &event);
         void toggleThreadRdp(wxCommandEvent &event);
         void toggleTexFilter(wxCommandEvent &event);
+        void toggleDynRate(wxCommandEvent &event);
+        void setFrameskip(wxCommandEvent &event);
+        void setAudioQuality(wxCommandEvent &event);
         void updateJoystick(wxTimerEvent &event);
         void dropFiles(wxDropFilesEvent &event);
         void close(wxCloseEvent &event);
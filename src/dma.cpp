@@ -0,0 +1,98 @@
+/*
+    Copyright 2022-2024 Hydr8gon
+
+    This file is part of rokuyon.
+
+    rokuyon is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    rokuyon is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with rokuyon. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#include "dma.h"
+#include "core.h"
+#include "memory.h"
+#include "settings.h"
+#include "trace.h"
+
+namespace DMA
+{
+    std::atomic<uint64_t> byteCounts[3];
+}
+
+void DMA::copy(uint32_t dstAddr, uint32_t srcAddr, uint32_t size)
+{
+    // Copy data between physical addresses, in bulk wherever both sides map directly to memory
+    // Data is stored big-endian in host memory as well, so no byteswapping is needed
+    uint64_t start = Trace::begin();
+    int64_t total = size;
+    while (size > 0)
+    {
+        // Keep addresses within the physical address space
+        srcAddr &= 0x1FFFFFFF;
+        dstAddr &= 0x1FFFFFFF;
+
+        uint32_t srcSize, dstSize;
+        uint8_t *src = Memory::getPointer(srcAddr, srcSize, false);
+        uint8_t *dst = Memory::getPointer(dstAddr, dstSize, true);
+
+        if (src && dst)
+        {
+            // Copy as much as possible until either mapping ends
+            uint32_t count = std::min(size, std::min(srcSize, dstSize));
+            memmove(dst, src, count);
+            Memory::markDirty(dstAddr, count);
+            srcAddr += count;
+            dstAddr += count;
+            size -= count;
+        }
+        else
+        {
+            // Fall back to a regular byte access for I/O and other special regions
+            uint8_t value = Memory::read<uint8_t>(0x80000000 + srcAddr++);
+            Memory::write<uint8_t>(0x80000000 + dstAddr++, value);
+            size--;
+        }
+    }
+
+    Trace::end("DMA Copy", start, total);
+}
+
+uint32_t DMA::getCycles(DmaType type, uint32_t size)
+{
+    // Count the transferred bytes; every DMA asks for its timing once, and only the emulator thread does
+    byteCounts[type].store(byteCounts[type].load(std::memory_order_relaxed) + size, std::memory_order_relaxed);
+
+    // Get how long a DMA should take to finish, or 0 if DMAs should finish instantly
+    if (!Settings::dmaTiming)
+        return 0;
+
+    // Use the configured transfer speeds, in scheduler cycles (93.75 * 2 MHz)
+    // By default, PI is about 10MB/s from the cart, SI includes joybus processing in the PIF,
+    // and SP moves 8 bytes per RCP cycle, which is 3 scheduler cycles
+    switch (type)
+    {
+        case DMA_PI: return size * std::max(0, Settings::dmaPiCycles);
+        case DMA_SI: return std::max(0, Settings::dmaSiCycles);
+        default: return std::max(1U, size * 3 / std::max(1, Settings::dmaSpBytes));
+    }
+}
+
+void DMA::getStats(CoreStats &stats)
+{
+    // Get the total bytes transferred by each type of DMA
+    for (int i = 0; i < 3; i++)
+        stats.dmaBytes[i] = byteCounts[i].load(std::memory_order_relaxed);
+}
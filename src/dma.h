@@ -0,0 +1,41 @@
+/*
+    Copyright 2022-2024 Hydr8gon
+
+    This file is part of rokuyon.
+
+    rokuyon is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    rokuyon is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with rokuyon. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef DMA_H
+#define DMA_H
+
+#include <cstdint>
+
+struct CoreStats;
+
+enum DmaType
+{
+    DMA_PI = 0,
+    DMA_SI,
+    DMA_SP
+};
+
+namespace DMA
+{
+    void copy(uint32_t dstAddr, uint32_t srcAddr, uint32_t size);
+    uint32_t getCycles(DmaType type, uint32_t size);
+    void getStats(CoreStats &stats);
+}
+
+#endif // DMA_H
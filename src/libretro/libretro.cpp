@@ -13,6 +13,7 @@
 #include "../vi.h"
 #include "../memory.h"
 #include "../core.h"
+#include "../rewind.h"
 #include "../settings.h"
 
 #ifndef VERSION
@@ -29,6 +30,11 @@ static struct retro_log_callback logging;
 static retro_log_printf_t logCallback;
 
 static bool cropBorders;
+static int runAhead;
+static bool runAheadRdp;
+static bool audioUnderrunLikely;
+static bool persistentData;
+static bool startupLogged;
 
 static std::string systemPath;
 static std::string savesPath;
@@ -38,6 +44,8 @@ static std::string savePath;
 
 static GameInfo gameInfo = {};
 
+static std::vector<uint8_t> runAheadState;
+
 static std::vector<uint32_t> videoBuffer;
 static uint32_t videoBufferSize;
 
@@ -172,6 +180,7 @@ static void initInput(void)
     { 0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_R, "R" },
     { 0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_L, "L" },
     { 0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_L2, "Z" },
+    { 0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_L3, "Rewind" },
     { 0, RETRO_DEVICE_ANALOG, RETRO_DEVICE_INDEX_ANALOG_LEFT, RETRO_DEVICE_ID_ANALOG_X, "Stick X" },
     { 0, RETRO_DEVICE_ANALOG, RETRO_DEVICE_INDEX_ANALOG_LEFT, RETRO_DEVICE_ID_ANALOG_Y, "Stick Y" },
     { 0, RETRO_DEVICE_ANALOG, RETRO_DEVICE_INDEX_ANALOG_RIGHT, RETRO_DEVICE_ID_ANALOG_X, "C-Pad X" },
@@ -185,25 +194,60 @@ static void initInput(void)
 static void initConfig()
 {
   static const retro_variable values[] = {
-    { "rokuyon_fpsLimiter", "FPS Limiter; disabled|enabled" },
     { "rokuyon_expansionPak", "Expansion Pak; disabled|enabled" },
+    { "rokuyon_dmaTiming", "DMA Timing; enabled|disabled" },
+    { "rokuyon_mmapSaves", "Memory-Mapped Saves; disabled|enabled" },
+    { "rokuyon_rewind", "Rewind (Hold L3); disabled|enabled" },
     { "rokuyon_threadedRdp", "Threaded RDP; disabled|enabled" },
     { "rokuyon_texFilter", "Texture Filter; disabled|enabled" },
+    { "rokuyon_audioQuality", "Audio Resampling; sinc|cubic|linear" },
     { "rokuyon_cropBorders", "Crop Borders; disabled|enabled" },
+    { "rokuyon_runAhead", "Run-Ahead Frames; 0|1|2|3" },
+    { "rokuyon_runAheadRdp", "Run-Ahead Hidden Frame Rendering; enabled|disabled" },
+    { "rokuyon_frameskip", "Frameskip; disabled|auto|fixed" },
+    { "rokuyon_frameskipInterval", "Frameskip Interval; 1|2|3|4|5" },
     { nullptr, nullptr }
   };
 
   envCallback(RETRO_ENVIRONMENT_SET_VARIABLES, (void*)values);
 }
 
+static void audioBufferStatus(bool active, unsigned occupancy, bool underrunLikely)
+{
+  audioUnderrunLikely = active && underrunLikely;
+}
+
 static void updateConfig()
 {
-  Settings::fpsLimiter = fetchVariableBool("rokuyon_fpsLimiter", false);
   Settings::expansionPak = fetchVariableBool("rokuyon_expansionPak", false);
+  Settings::dmaTiming = fetchVariableBool("rokuyon_dmaTiming", true);
+  Settings::mmapSaves = fetchVariableBool("rokuyon_mmapSaves", false);
+  Settings::rewind = fetchVariableBool("rokuyon_rewind", false);
   Settings::threadedRdp = fetchVariableBool("rokuyon_threadedRdp", false);
   Settings::texFilter = fetchVariableBool("rokuyon_texFilter", false);
 
+  // The frontend paces frames and handles its own rate control, so run unthrottled at the nominal rate
+  Settings::fpsLimiter = 0;
+  Settings::dynamicRate = 0;
+
+  // The frontend has its own automatic save states
+  Settings::instantResume = 0;
+
+  std::string audioQuality = fetchVariable("rokuyon_audioQuality", "sinc");
+  Settings::audioQuality = (audioQuality == "linear") ? 0 : (audioQuality == "cubic") ? 1 : 2;
+
   cropBorders = fetchVariableBool("rokuyon_cropBorders", false);
+  runAhead = std::stoi(fetchVariable("rokuyon_runAhead", "0"));
+  runAheadRdp = fetchVariableBool("rokuyon_runAheadRdp", true);
+
+  std::string frameskip = fetchVariable("rokuyon_frameskip", "disabled");
+  Settings::frameskip = (frameskip == "auto") ? 1 : (frameskip == "fixed") ? 2 : 0;
+  Settings::frameskipInterval = std::stoi(fetchVariable("rokuyon_frameskipInterval", "1"));
+
+  // Automatic frameskip is driven by how full the frontend's audio buffer is
+  struct retro_audio_buffer_status_callback bufferStatus = { audioBufferStatus };
+  audioUnderrunLikely = false;
+  envCallback(RETRO_ENVIRONMENT_SET_AUDIO_BUFFER_STATUS_CALLBACK, (Settings::frameskip == 1) ? &bufferStatus : nullptr);
 }
 
 static void checkConfigVariables()
@@ -282,61 +326,38 @@ static void renderVideo()
 
 static void renderAudio()
 {
-  static int16_t buffer[1024 * 2];
-  AI::fillBuffer((uint32_t*)buffer);
+  static int16_t buffer[0x2000 * 2];
+  uint32_t size = AI::drainBuffer((uint32_t*)buffer, sizeof(buffer) / (2 * sizeof(int16_t)));
 
-  uint32_t size = sizeof(buffer) / (2 * sizeof(int16_t));
-  audioBatchCallback(buffer, size);
+  if (size > 0)
+    audioBatchCallback(buffer, size);
 }
 
-static uint8_t* convertRom(const void* data, const size_t& size)
+static void runAheadFrames()
 {
-  const uint8_t* input = reinterpret_cast<const uint8_t*>(data);
-  uint8_t* output = new uint8_t[size];
+  // Run the real frame with audio, and take a snapshot of the machine after it
+  Core::skipVideo = true;
+  Core::runFrame();
+  renderAudio();
 
-  // Extract the first four bytes
-  uint32_t header = (input[0] << 24) | (input[1] << 16) | (input[2] << 8) | input[3];
+  size_t size = Core::stateSize();
+  if (runAheadState.size() != size) runAheadState.resize(size);
+  Core::saveState(runAheadState.data(), size);
 
-  // Known ROM format headers
-  const uint32_t N64_HEADER = 0x40123780; // Little Endian (.n64)
-  const uint32_t V64_HEADER = 0x37804012; // Byte Swapped (.v64)
-  const uint32_t Z64_HEADER = 0x80371240; // Big Endian (.z64)
+  // Run hidden frames ahead with the same input, optionally without rendering
+  Core::skipAudio = true;
+  Core::skipRdp = !runAheadRdp;
+  for (int i = 1; i < runAhead; i++)
+    Core::runFrame();
 
-  switch (header)
-  {
-    case N64_HEADER:
-      // Reverse bytes in 4-byte chunks
-      logCallback(RETRO_LOG_INFO, "Detected ROM format: N64\n");
-      for (size_t i = 0; i < size; i += 4)
-      {
-        output[i + 0] = input[i + 3];
-        output[i + 1] = input[i + 2];
-        output[i + 2] = input[i + 1];
-        output[i + 3] = input[i + 0];
-      }
-      break;
-    case V64_HEADER:
-      // Swap adjacent bytes in 2-byte chunks
-      logCallback(RETRO_LOG_INFO, "Detected ROM format: V64\n");
-      for (size_t i = 0; i < size; i += 2)
-      {
-        output[i + 0] = input[i + 1];
-        output[i + 1] = input[i + 0];
-      }
-      break;
-    case Z64_HEADER:
-      // No change needed, copy the data as is
-      logCallback(RETRO_LOG_INFO, "Detected ROM format: Z64\n");
-      memcpy(output, input, size);
-      break;
-    default:
-      // Unknown format, copy the data as is
-      logCallback(RETRO_LOG_INFO, "Detected ROM format: Unknown\n");
-      memcpy(output, input, size);
-      break;
-  }
+  // Run the last frame fully rendered and display it
+  Core::skipVideo = Core::skipRdp = false;
+  Core::runFrame();
+  renderVideo();
 
-  return output;
+  // Roll back to the real frame
+  Core::skipAudio = false;
+  Core::loadState(runAheadState.data(), size);
 }
 
 void retro_get_system_info(retro_system_info* info)
@@ -364,11 +385,12 @@ void retro_get_system_av_info(retro_system_av_info* info)
 void retro_set_environment(retro_environment_t cb)
 {
   const struct retro_system_content_info_override contentOverrides[] = {
-    { "z64|n64|v64", false, false },
+    { "z64|n64|v64", false, true },
     {}
   };
 
-  cb(RETRO_ENVIRONMENT_SET_CONTENT_INFO_OVERRIDE, (void*)contentOverrides);
+  // Big-endian ROMs can be used in place if the frontend keeps the content data around
+  persistentData = cb(RETRO_ENVIRONMENT_SET_CONTENT_INFO_OVERRIDE, (void*)contentOverrides);
 
   envCallback = cb;
 }
@@ -427,8 +449,8 @@ bool retro_load_game(const struct retro_game_info* info)
 
   Core::stop();
 
-  Core::rom = convertRom(info->data, info->size);
-  Core::romSize = (uint32_t)info->size;
+  Core::loadRom((const uint8_t*)info->data, (uint32_t)info->size, persistentData);
+  startupLogged = false;
 
   Core::savePath = savePath;
   Core::saveSize = 0;
@@ -459,17 +481,24 @@ void retro_unload_game(void)
 {
   Core::stop();
 
-  Core::romSize = 0;
-  if (Core::rom) delete[] Core::rom;
+  if (Settings::rewind)
+  {
+    RewindStats stats = Rewind::getStats();
+    logCallback(RETRO_LOG_INFO, "Rewind history: %.0fs in %.1fMB (%.0fKB/s), %.0fus/frame\n", stats.seconds,
+      stats.memoryUsage / 1048576.0f, stats.bytesPerSecond / 1024, stats.captureTime);
+  }
+
+  Core::unloadRom();
 
+  Core::unloadSave();
   Core::saveSize = 0;
-  if (Core::save) delete[] Core::save;
 }
 
 void retro_reset(void)
 {
   Core::stop();
   Core::bootRom(gamePath);
+  startupLogged = false;
 }
 
 void retro_run(void)
@@ -490,6 +519,7 @@ void retro_run(void)
   }
 
   PIF::setStick(stickX, stickY);
+  Rewind::setActive(getButtonState(RETRO_DEVICE_ID_JOYPAD_L3));
 
   float cpadX = getAxisState(RETRO_DEVICE_INDEX_ANALOG_RIGHT, RETRO_DEVICE_ID_ANALOG_X);
   float cpadY = getAxisState(RETRO_DEVICE_INDEX_ANALOG_RIGHT, RETRO_DEVICE_ID_ANALOG_Y);
@@ -517,12 +547,25 @@ void retro_run(void)
       PIF::releaseKey(i);
   }
 
-  Core::start();
+  if (runAhead > 0)
+  {
+    Core::skipFrame = false;
+    runAheadFrames();
+  }
+  else
+  {
+    Core::updateFrameskip(audioUnderrunLikely);
+    Core::runFrame();
 
-  renderVideo();
-  renderAudio();
+    renderVideo();
+    renderAudio();
+  }
 
-  Core::stop();
+  if (!startupLogged && Core::startupTime > 0)
+  {
+    logCallback(RETRO_LOG_INFO, "Startup took %.2fms\n", Core::startupTime);
+    startupLogged = true;
+  }
 }
 
 void retro_set_controller_port_device(unsigned port, unsigned device)
@@ -531,18 +574,17 @@ void retro_set_controller_port_device(unsigned port, unsigned device)
 
 size_t retro_serialize_size(void)
 {
-  size_t size = 0;
-  return size;
+  return Core::stateSize();
 }
 
 bool retro_serialize(void* data, size_t size)
 {
-  return false;
+  return Core::saveState((uint8_t*)data, size);
 }
 
 bool retro_unserialize(const void* data, size_t size)
 {
-  return false;
+  return Core::loadState((const uint8_t*)data, size);
 }
 
 unsigned retro_get_region(void)
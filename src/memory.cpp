@@ -33,6 +33,7 @@
 #include "rsp_cp0.h"
 #include "settings.h"
 #include "si.h"
+#include "state.h"
 #include "vi.h"
 
 enum FlashState
@@ -55,6 +56,7 @@ struct TLBEntry
 namespace Memory
 {
     uint8_t rdram[0x800000]; // 8MB RDRAM
+    std::atomic<uint32_t> dirtyPages[0x800 / 32]; // 1 bit per 4KB page of RDRAM, set from any thread
     uint8_t rspMem[0x2000];  // 4KB RSP DMEM + 4KB RSP IMEM
     TLBEntry entries[32];
     uint32_t ramSize;
@@ -72,6 +74,7 @@ void Memory::reset()
 {
     // Reset memory to its initial state
     memset(rdram, 0, sizeof(rdram));
+    setDirty(true);
     memset(rspMem, 0, sizeof(rspMem));
     memset(writeBuf, 0, sizeof(writeBuf));
     ramSize = Settings::expansionPak ? 0x800000 : 0x400000;
@@ -84,6 +87,41 @@ void Memory::reset()
         entries[i].entryHi = 0x80000000;
 }
 
+void Memory::setDirty(bool dirty)
+{
+    // Mark all RDRAM pages as written or unwritten
+    for (int i = 0; i < 0x800 / 32; i++)
+        dirtyPages[i].store(dirty ? 0xFFFFFFFF : 0, std::memory_order_relaxed);
+}
+
+void Memory::saveState(State &state)
+{
+    // Save the used part of RDRAM, RSP memory, the TLB, and FLASH state
+    state.write(rdram, ramSize);
+    state.write(rspMem);
+    state.write(entries);
+    state.write(writeBuf);
+    state.write(status);
+    state.write(writeOfs);
+    state.write(eraseOfs);
+    state.write(Memory::state);
+}
+
+void Memory::loadState(State &state)
+{
+    // Load the used part of RDRAM, RSP memory, the TLB, and FLASH state
+    // All of RDRAM is marked dirty, since any page could have changed
+    state.read(rdram, ramSize);
+    setDirty(true);
+    state.read(rspMem);
+    state.read(entries);
+    state.read(writeBuf);
+    state.read(status);
+    state.read(writeOfs);
+    state.read(eraseOfs);
+    state.read(Memory::state);
+}
+
 void Memory::getEntry(uint32_t index, uint32_t &entryLo0, uint32_t &entryLo1, uint32_t &entryHi, uint32_t &pageMask)
 {
     // Get the TLB entry at the given index
@@ -104,6 +142,71 @@ void Memory::setEntry(uint32_t index, uint32_t entryLo0, uint32_t entryLo1, uint
     entry.pageMask = pageMask;
 }
 
+uint8_t *Memory::getPointer(uint32_t pAddr, uint32_t &size, bool write)
+{
+    // Get a host pointer to a physical address that maps directly to memory, along with the size until the mapping ends
+    // Regions with side effects return null so they can be accessed through the normal read/write functions
+    uint32_t end;
+    uint8_t *data;
+
+    if (pAddr < ramSize)
+    {
+        // Get a pointer to data in RDRAM
+        data = &rdram[pAddr];
+        end = ramSize;
+    }
+    else if (pAddr >= 0x4000000 && pAddr < 0x4040000)
+    {
+        // Get a pointer to data in RSP DMEM/IMEM, up to where it wraps around
+        data = &rspMem[pAddr & 0x1FFF];
+        end = (pAddr | 0xFFF) + 1;
+    }
+    else if (pAddr >= 0x8000000 && pAddr < 0x8008000 && Core::saveSize == 0x8000 && !write)
+    {
+        // Get a pointer to data in cart SRAM, if it exists; writes have to mark the save as dirty
+        data = &Core::save[pAddr & 0x7FFF];
+        end = 0x8008000;
+    }
+    else if (pAddr >= 0x8000000 && pAddr < 0x8020000 && Core::saveSize == 0x20000 && state == FLASH_READ && !write)
+    {
+        // Get a pointer to data in cart FLASH, if it's readable
+        data = &Core::save[pAddr & 0x1FFFF];
+        end = 0x8020000;
+    }
+    else if (pAddr >= 0x10000000 && pAddr < 0x10000000 + std::min(Core::romSize, 0xFC00000U) && !write)
+    {
+        // Get a pointer to data in cart ROM
+        data = &Core::rom[pAddr - 0x10000000];
+        end = 0x10000000 + std::min(Core::romSize, 0xFC00000U);
+    }
+    else if (pAddr >= 0x1FC00000 && pAddr < 0x1FC00800 && !write)
+    {
+        // Get a pointer to data in PIF ROM/RAM
+        data = &PIF::memory[pAddr & 0x7FF];
+        end = 0x1FC00800;
+    }
+    else if (pAddr >= 0x1FC007C0 && pAddr < 0x1FC007FF)
+    {
+        // Get a pointer to data in PIF RAM, stopping before the command byte so writing it calls the PIF
+        data = &PIF::memory[pAddr & 0x7FF];
+        end = 0x1FC007FF;
+    }
+    else
+    {
+        return nullptr;
+    }
+
+    size = end - pAddr;
+    return data;
+}
+
+void Memory::markDirty(uint32_t pAddr, uint32_t size)
+{
+    // Mark the RDRAM pages in a range of physical addresses as written
+    for (uint32_t page = pAddr >> 12; page <= (pAddr + size - 1) >> 12 && page < 0x800; page++)
+        dirtyPages[page >> 5].fetch_or(1 << (page & 0x1F), std::memory_order_relaxed);
+}
+
 template uint8_t  Memory::read(uint32_t address);
 template uint16_t Memory::read(uint32_t address);
 template uint32_t Memory::read(uint32_t address);
@@ -295,9 +398,14 @@ lookup:
     // Look up the physical address
     if (pAddr < ramSize)
     {
-        // Get a pointer to data in RDRAM
+        // Get a pointer to data in RDRAM, and mark its page as written
         // TODO: figure out RDRAM registers and how they affect mapping
+        // The bit is only set atomically if it isn't already, since the RDP thread can write at the same time
         data = &rdram[pAddr];
+        std::atomic<uint32_t> &dirty = dirtyPages[(pAddr >> 17) & (0x800 / 32 - 1)];
+        uint32_t bit = 1 << ((pAddr >> 12) & 0x1F);
+        if (!(dirty.load(std::memory_order_relaxed) & bit))
+            dirty.fetch_or(bit, std::memory_order_relaxed);
     }
     else if (pAddr >= 0x4000000 && pAddr < 0x4040000)
     {
@@ -20,13 +20,25 @@
 #ifndef MEMORY_H
 #define MEMORY_H
 
+#include <atomic>
 #include <cstdint>
 
+struct State;
+
 namespace Memory
 {
+    extern uint8_t rdram[0x800000];
+    extern std::atomic<uint32_t> dirtyPages[0x800 / 32];
+    extern uint32_t ramSize;
+
     void reset();
+    void setDirty(bool dirty);
+    void saveState(State &state);
+    void loadState(State &state);
     void getEntry(uint32_t index, uint32_t &entryLo0, uint32_t &entryLo1, uint32_t &entryHi, uint32_t &pageMask);
     void setEntry(uint32_t index, uint32_t  entryLo0, uint32_t  entryLo1, uint32_t  entryHi, uint32_t  pageMask);
+    uint8_t *getPointer(uint32_t pAddr, uint32_t &size, bool write);
+    void markDirty(uint32_t pAddr, uint32_t size);
 
     template <typename T> T read(uint32_t address);
     template <typename T> void write(uint32_t address, T value);
@@ -20,6 +20,7 @@
 #include "mi.h"
 #include "cpu_cp0.h"
 #include "log.h"
+#include "state.h"
 
 namespace MI
 {
@@ -34,6 +35,20 @@ void MI::reset()
     mask = 0;
 }
 
+void MI::saveState(State &state)
+{
+    // Save the MI interrupt registers
+    state.write(interrupt);
+    state.write(mask);
+}
+
+void MI::loadState(State &state)
+{
+    // Load the MI interrupt registers
+    state.read(interrupt);
+    state.read(mask);
+}
+
 uint32_t MI::read(uint32_t address)
 {
     // Read from an I/O register if one exists at the given address
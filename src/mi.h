@@ -22,12 +22,16 @@
 
 #include <cstdint>
 
+struct State;
+
 namespace MI
 {
     extern uint32_t interrupt;
     extern uint32_t mask;
 
     void reset();
+    void saveState(State &state);
+    void loadState(State &state);
     uint32_t read(uint32_t address);
     void write(uint32_t address, uint32_t value);
 
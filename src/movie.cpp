@@ -0,0 +1,182 @@
+/*
+    Copyright 2022-2024 Hydr8gon
+
+    This file is part of rokuyon.
+
+    rokuyon is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    rokuyon is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with rokuyon. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "movie.h"
+#include "log.h"
+
+#define MOVIE_MAGIC "rokuyon-movie"
+#define MOVIE_VERSION 1
+
+struct MovieEntry
+{
+    uint32_t poll;
+    uint16_t buttons;
+    int8_t stickX;
+    int8_t stickY;
+};
+
+enum MovieMode
+{
+    MOVIE_OFF = 0,
+    MOVIE_RECORD,
+    MOVIE_PLAY
+};
+
+namespace Movie
+{
+    MovieMode mode;
+    std::string moviePath;
+    std::vector<MovieEntry> entries;
+    size_t next;
+    uint32_t polls;
+    MovieEntry current;
+}
+
+bool Movie::record(const std::string &path)
+{
+    // Check that the movie file can be written before anything is recorded
+    stop();
+    FILE *file = fopen(path.c_str(), "w");
+    if (!file) return false;
+    fclose(file);
+
+    // Start recording from the current poll, which should be right after a reset
+    moviePath = path;
+    mode = MOVIE_RECORD;
+    entries.clear();
+    reset();
+    LOG_INFO("Started recording input movie to %s\n", path.c_str());
+    return true;
+}
+
+bool Movie::play(const std::string &path)
+{
+    // Open the movie file and check its header
+    stop();
+    FILE *file = fopen(path.c_str(), "r");
+    if (!file) return false;
+
+    char line[256];
+    int version = 0;
+    if (!fgets(line, sizeof(line), file) || sscanf(line, MOVIE_MAGIC " %d", &version) != 1 || version != MOVIE_VERSION)
+    {
+        LOG_WARN("Unsupported input movie: %s\n", path.c_str());
+        fclose(file);
+        return false;
+    }
+
+    // Load the state changes, which are in poll order
+    entries.clear();
+    while (fgets(line, sizeof(line), file))
+    {
+        MovieEntry entry;
+        unsigned int buttons;
+        int x, y;
+        if (sscanf(line, "%u %x %d %d", &entry.poll, &buttons, &x, &y) != 4)
+            continue;
+        entry.buttons = buttons;
+        entry.stickX = x;
+        entry.stickY = y;
+        if (!entries.empty() && entry.poll < entries.back().poll)
+        {
+            LOG_WARN("Input movie entries out of order: %s\n", path.c_str());
+            entries.clear();
+            fclose(file);
+            return false;
+        }
+        entries.push_back(entry);
+    }
+    fclose(file);
+
+    // Start playing from the current poll, which should be right after a reset
+    moviePath = path;
+    mode = MOVIE_PLAY;
+    reset();
+    LOG_INFO("Started playing input movie from %s\n", path.c_str());
+    return true;
+}
+
+void Movie::stop()
+{
+    // Write out a recording, ending with the total number of polls so playback length is known
+    if (mode == MOVIE_RECORD)
+    {
+        if (FILE *file = fopen(moviePath.c_str(), "w"))
+        {
+            fprintf(file, MOVIE_MAGIC " %d\n", MOVIE_VERSION);
+            for (size_t i = 0; i < entries.size(); i++)
+                fprintf(file, "%u %04X %d %d\n", entries[i].poll, entries[i].buttons, entries[i].stickX, entries[i].stickY);
+            fprintf(file, "# %u polls\n", polls);
+            fclose(file);
+        }
+        else
+        {
+            LOG_WARN("Failed to write input movie: %s\n", moviePath.c_str());
+        }
+    }
+
+    // Release the movie
+    mode = MOVIE_OFF;
+    entries.clear();
+    entries.shrink_to_fit();
+}
+
+bool Movie::isActive()
+{
+    // Check if input is being recorded or played
+    return mode != MOVIE_OFF;
+}
+
+void Movie::reset()
+{
+    // Restart the movie along with the PIF, dropping anything recorded before it
+    if (mode == MOVIE_RECORD)
+        entries.clear();
+    memset(&current, 0, sizeof(current));
+    next = 0;
+    polls = 0;
+}
+
+void Movie::poll(uint16_t &buttons, int8_t &stickX, int8_t &stickY)
+{
+    if (mode == MOVIE_RECORD)
+    {
+        // Log the controller state whenever it differs from the last poll
+        if (buttons != current.buttons || stickX != current.stickX || stickY != current.stickY)
+        {
+            MovieEntry entry = { polls, buttons, stickX, stickY };
+            entries.push_back(entry);
+            current = entry;
+        }
+    }
+    else if (mode == MOVIE_PLAY)
+    {
+        // Replace the controller state with the movie's, holding the last state once it runs out
+        for (; next < entries.size() && entries[next].poll <= polls; next++)
+            current = entries[next];
+        buttons = current.buttons;
+        stickX = current.stickX;
+        stickY = current.stickY;
+    }
+    polls++;
+}
@@ -0,0 +1,39 @@
+/*
+    Copyright 2022-2024 Hydr8gon
+
+    This file is part of rokuyon.
+
+    rokuyon is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    rokuyon is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with rokuyon. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <cstdint>
+#include <string>
+
+// Input movies log controller 1 as it's read by the game, so the same input can be replayed exactly
+// Entries are keyed to the number of controller polls since the PIF was reset, not to frames or time
+namespace Movie
+{
+    bool record(const std::string &path);
+    bool play(const std::string &path);
+    void stop();
+    bool isActive();
+
+    void reset();
+    void poll(uint16_t &buttons, int8_t &stickX, int8_t &stickY);
+}
+
+#endif // MOVIE_H
@@ -20,17 +20,27 @@
 #include <algorithm>
 
 #include "pi.h"
+#include "core.h"
+#include "cpu.h"
+#include "dma.h"
 #include "log.h"
-#include "memory.h"
 #include "mi.h"
+#include "state.h"
+
+// Longest gap between busy reads that still counts as a polling loop, in scheduler cycles
+#define POLL_CYCLES 64
 
 namespace PI
 {
     uint32_t dramAddr;
     uint32_t cartAddr;
+    bool dmaBusy;
+    uint32_t pollAddr;
+    uint32_t pollCycles;
 
     void performReadDma(uint32_t length);
     void performWriteDma(uint32_t length);
+    void startDma(uint32_t length);
 }
 
 void PI::reset()
@@ -38,6 +48,25 @@ void PI::reset()
     // Reset the PI to its initial state
     dramAddr = 0;
     cartAddr = 0;
+    dmaBusy = false;
+    pollAddr = 0;
+    pollCycles = 0;
+}
+
+void PI::saveState(State &state)
+{
+    // Save the PI registers and DMA state
+    state.write(dramAddr);
+    state.write(cartAddr);
+    state.write(dmaBusy);
+}
+
+void PI::loadState(State &state)
+{
+    // Load the PI registers and DMA state
+    state.read(dramAddr);
+    state.read(cartAddr);
+    state.read(dmaBusy);
 }
 
 uint32_t PI::read(uint32_t address)
@@ -45,6 +74,20 @@ uint32_t PI::read(uint32_t address)
     // Read from an I/O register if one exists at the given address
     switch (address)
     {
+        case 0x4600010: // PI_STATUS
+            // If the same instruction sees the DMA busy again shortly after, the CPU is waiting in a polling loop
+            // Halt it until the DMA finishes instead of running the loop, since nothing else can change the result
+            if (dmaBusy)
+            {
+                if (pollAddr == CPU::programCounter && Core::globalCycles - pollCycles < POLL_CYCLES)
+                    Core::cpuRunning = false;
+                pollAddr = CPU::programCounter;
+                pollCycles = Core::globalCycles;
+            }
+
+            // Get the DMA busy and interrupt bits
+            return (dmaBusy ? 0x1 : 0) | ((MI::interrupt & (1 << 4)) ? 0x8 : 0);
+
         default:
             LOG_WARN("Unknown PI register read: 0x%X\n", address);
             return 0;
@@ -77,8 +120,15 @@ void PI::write(uint32_t address, uint32_t value)
             return;
 
         case 0x4600010: // PI_STATUS
+            // Stop a DMA in progress when bit 0 is set, dropping its scheduled finish
+            if ((value & 0x1) && dmaBusy)
+            {
+                Core::unschedule(PI_FINISH_DMA);
+                dmaBusy = false;
+                pollAddr = 0;
+            }
+
             // Acknowledge a PI interrupt when bit 1 is set
-            // TODO: handle bit 0
             if (value & 0x2)
                 MI::clearInterrupt(4);
             return;
@@ -91,35 +141,58 @@ void PI::write(uint32_t address, uint32_t value)
 
 void PI::performReadDma(uint32_t size)
 {
-    LOG_INFO("PI DMA from cart 0x%X to RDRAM 0x%X with size 0x%X\n", cartAddr, dramAddr, size);
-
-    // Copy data from the PI bus to memory
-    // TODO: check bounds
-    for (uint32_t i = 0; i < size; i++)
+    // Ignore DMAs started while one is in progress, since the hardware does
+    if (dmaBusy)
     {
-        uint8_t value = Memory::read<uint8_t>(0x80000000 + cartAddr + i);
-        Memory::write<uint8_t>(0x80000000 + dramAddr + i, value);
+        LOG_WARN("PI DMA started while busy\n");
+        return;
     }
 
-    // Request a PI interrupt when the DMA finishes
-    // TODO: make DMAs not instant
-    MI::setInterrupt(4);
-}
+    LOG_INFO("PI DMA from cart 0x%X to RDRAM 0x%X with size 0x%X\n", cartAddr, dramAddr, size);
 
+    // Copy data from the PI bus to memory
+    DMA::copy(dramAddr, cartAddr, size);
+    startDma(size);
+}
 
 void PI::performWriteDma(uint32_t size)
 {
+    // Ignore DMAs started while one is in progress, since the hardware does
+    if (dmaBusy)
+    {
+        LOG_WARN("PI DMA started while busy\n");
+        return;
+    }
+
     LOG_INFO("PI DMA from RDRAM 0x%X to cart 0x%X with size 0x%X\n", dramAddr, cartAddr, size);
 
     // Copy data from memory to the PI bus
-    // TODO: check bounds
-    for (uint32_t i = 0; i < size; i++)
+    DMA::copy(cartAddr, dramAddr, size);
+    startDma(size);
+}
+
+void PI::startDma(uint32_t size)
+{
+    // Schedule the end of a DMA based on its size, or finish it right away if timing is disabled
+    // The data is already copied, so the CPU can run alongside the transfer like on hardware
+    if (uint32_t cycles = DMA::getCycles(DMA_PI, size))
     {
-        uint8_t value = Memory::read<uint8_t>(0x80000000 + dramAddr + i);
-        Memory::write<uint8_t>(0x80000000 + cartAddr + i, value);
+        dmaBusy = true;
+        Core::schedule(PI_FINISH_DMA, cycles);
+        return;
     }
 
-    // Request a PI interrupt when the DMA finishes
-    // TODO: make DMAs not instant
+    finishDma();
+}
+
+void PI::finishDma()
+{
+    // Clear the busy bit and request a PI interrupt when a DMA finishes
+    dmaBusy = false;
     MI::setInterrupt(4);
+
+    // Resume the CPU if it was halted while polling the busy bit
+    // If it was halted in an idle loop instead, it will just detect the loop and halt again
+    Core::cpuRunning = true;
+    pollAddr = 0;
 }
@@ -23,11 +23,17 @@
 #include <cstdint>
 #include <cstdio>
 
+struct State;
+
 namespace PI
 {
     void reset();
+    void saveState(State &state);
+    void loadState(State &state);
     uint32_t read(uint32_t address);
     void write(uint32_t address, uint32_t value);
+
+    void finishDma();
 }
 
 #endif // PI_H
@@ -24,7 +24,9 @@
 #include "cpu.h"
 #include "log.h"
 #include "memory.h"
+#include "movie.h"
 #include "settings.h"
+#include "state.h"
 
 namespace PIF
 {
@@ -79,6 +81,7 @@ void PIF::reset()
     buttons = 0;
     stickX = 0;
     stickY = 0;
+    Movie::reset();
 
     // Set a mask and ID for 0.5KB/2KB EEPROM, or disable EEPROM
     switch (Core::saveSize)
@@ -175,6 +178,24 @@ void PIF::reset()
     Memory::write<uint32_t>(0xA0000318, Settings::expansionPak ? 0x800000 : 0x400000);
 }
 
+void PIF::saveState(State &state)
+{
+    // Save PIF memory and command state, but not input, which comes from the frontend
+    state.write(memory);
+    state.write(eepromMask);
+    state.write(eepromId);
+    state.write(command);
+}
+
+void PIF::loadState(State &state)
+{
+    // Load PIF memory and command state
+    state.read(memory);
+    state.read(eepromMask);
+    state.read(eepromId);
+    state.read(command);
+}
+
 void PIF::runCommand()
 {
     // Update the current command if new command bits were set
@@ -254,12 +275,20 @@ void PIF::joybusProtocol(int bit)
                     break;
 
                 case 0x01: // Controller state
+                {
+                    // Let an input movie record or replace the state of controller 1 as the game reads it
+                    uint16_t pad = buttons;
+                    int8_t x = stickX, y = stickY;
+                    if (!channel && Movie::isActive())
+                        Movie::poll(pad, x, y);
+
                     // Report the state of controller 1 if the channel is 0
-                    memory[i + 3] = channel ? 0 : (buttons >> 8);
-                    memory[i + 4] = channel ? 0 : (buttons >> 0);
-                    memory[i + 5] = channel ? 0 : stickX;
-                    memory[i + 6] = channel ? 0 : stickY;
+                    memory[i + 3] = channel ? 0 : (pad >> 8);
+                    memory[i + 4] = channel ? 0 : (pad >> 0);
+                    memory[i + 5] = channel ? 0 : x;
+                    memory[i + 6] = channel ? 0 : y;
                     break;
+                }
 
                 case 0x04: // Read EEPROM block
                     if ((channel & ~1) == 4) // Channels 4 and 5
@@ -23,11 +23,15 @@
 #include <cstdint>
 #include <cstdio>
 
+struct State;
+
 namespace PIF
 {
     extern uint8_t memory[0x800];
 
     void reset();
+    void saveState(State &state);
+    void loadState(State &state);
     void runCommand();
 
     void pressKey(int key);
@@ -0,0 +1,279 @@
+/*
+    Copyright 2022-2024 Hydr8gon
+
+    This file is part of rokuyon.
+
+    rokuyon is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    rokuyon is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with rokuyon. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <unordered_set>
+#include <unordered_map>
+#include <vector>
+
+#include "profiler.h"
+#include "core.h"
+#include "cpu.h"
+#include "log.h"
+#include "memory.h"
+#include "rsp.h"
+#include "settings.h"
+
+#define TOP_COUNT 40         // Entries to list in each section of the profile
+#define BLOCK_LIMIT 64       // Instructions to search back for the start of a basic block
+#define SYMBOL_RANGE 0x10000 // Largest offset from a symbol to still name an address with it
+
+namespace Profiler
+{
+    std::unordered_map<uint32_t, uint64_t> cpuHits;
+    std::unordered_map<uint32_t, uint64_t> rspHits;
+    std::unordered_map<const char*, uint64_t> opcodeHits;
+    uint64_t cpuSamples;
+    uint64_t rspSamples;
+    uint32_t jitter;
+
+    bool peek(uint32_t address, uint32_t &opcode);
+    bool branchTarget(uint32_t address, uint32_t &target);
+    uint32_t blockStart(uint32_t address, const std::unordered_set<uint32_t> &targets);
+    bool parseAddress(const char *str, uint32_t &address);
+    void loadMap(const std::string &path, std::map<uint32_t, std::string> &symbols);
+    std::string symbolize(uint32_t address, const std::map<uint32_t, std::string> &symbols);
+    void writeTop(FILE *file, const std::unordered_map<uint32_t, uint64_t> &hits, uint64_t total,
+        const std::map<uint32_t, std::string> *symbols, int digits);
+}
+
+void Profiler::reset()
+{
+    // Clear the histograms for a new session
+    cpuHits.clear();
+    rspHits.clear();
+    opcodeHits.clear();
+    cpuSamples = 0;
+    rspSamples = 0;
+    jitter = 1;
+}
+
+uint32_t Profiler::interval()
+{
+    // Vary the cycles between samples around the set interval, so loops can't line up with it
+    // A simple LCG is used so profiled runs stay reproducible
+    uint32_t base = std::max(Settings::profileInterval, 4);
+    jitter = jitter * 1103515245 + 12345;
+    return base - base / 4 + (jitter >> 16) % (base / 2 + 1);
+}
+
+void Profiler::sample()
+{
+    // Count the address of the next CPU instruction, along with its opcode class
+    uint32_t opcode, pc = CPU::nextAddress();
+    cpuHits[pc]++;
+    opcodeHits[peek(pc, opcode) ? CPU::opcodeName(opcode) : "unmapped"]++;
+    cpuSamples++;
+
+    // Count the address of the next RSP instruction if it's running
+    if (Core::rspRunning)
+    {
+        rspHits[RSP::readPC()]++;
+        rspSamples++;
+    }
+}
+
+bool Profiler::peek(uint32_t address, uint32_t &opcode)
+{
+    // Get a physical address from a virtual one, like a memory read but without raising exceptions
+    uint32_t pAddr = address & 0x1FFFFFFF;
+    if ((address & 0xC0000000) != 0x80000000)
+    {
+        bool found = false;
+        for (int i = 0; i < 32 && !found; i++)
+        {
+            uint32_t entryLo0, entryLo1, entryHi, pageMask;
+            Memory::getEntry(i, entryLo0, entryLo1, entryHi, pageMask);
+            uint32_t vAddr = entryHi & 0xFFFFE000;
+            uint32_t mask = pageMask | 0x1FFF;
+            if (address - vAddr > mask) continue;
+            uint32_t entryLo = (address - vAddr <= (mask >> 1)) ? entryLo0 : entryLo1;
+            pAddr = ((entryLo & 0x3FFFFC0) << 6) + (address & (mask >> 1));
+            found = true;
+        }
+        if (!found) return false;
+    }
+
+    // Read an instruction from memory that can be accessed directly, skipping I/O with side effects
+    uint32_t size;
+    uint8_t *data = Memory::getPointer(pAddr, size, false);
+    if (!data || size < 4) return false;
+    opcode = (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+    return true;
+}
+
+bool Profiler::branchTarget(uint32_t address, uint32_t &target)
+{
+    // Get the target of a jump or branch with a fixed destination
+    uint32_t opcode;
+    if (!peek(address, opcode) || !CPU::isBranch(opcode))
+        return false;
+    else if ((opcode >> 26) == 0x02 || (opcode >> 26) == 0x03) // j, jal
+        target = ((address + 4) & 0xF0000000) | ((opcode & 0x3FFFFFF) << 2);
+    else if ((opcode >> 26) != 0x00) // Relative branches
+        target = address + 4 + ((int16_t)opcode << 2);
+    else // jr, jalr
+        return false;
+    return true;
+}
+
+uint32_t Profiler::blockStart(uint32_t address, const std::unordered_set<uint32_t> &targets)
+{
+    // Search back for the instruction after a jump's delay slot or a sampled branch target, which starts a block
+    // Targets of branches that were never sampled aren't known, so this is an approximation
+    uint32_t opcode;
+    for (int i = 0; i < BLOCK_LIMIT && !targets.count(address); i++)
+    {
+        if (!peek(address - 8, opcode) || CPU::isBranch(opcode))
+            break;
+        address -= 4;
+    }
+    return address;
+}
+
+bool Profiler::parseAddress(const char *str, uint32_t &address)
+{
+    // Parse a hex address, which may be 64-bit or followed by a semicolon in linker scripts
+    char *end;
+    unsigned long long value = strtoull(str, &end, 16);
+    if (end == str || (*end && strcmp(end, ";"))) return false;
+    address = (uint32_t)value;
+    return true;
+}
+
+void Profiler::loadMap(const std::string &path, std::map<uint32_t, std::string> &symbols)
+{
+    FILE *file = fopen(path.c_str(), "r");
+    if (!file)
+    {
+        LOG_WARN("Failed to open symbol map: %s\n", path.c_str());
+        return;
+    }
+
+    // Parse symbols from lines like "80000400 main", "80000400 T main", or "main = 0x80000400;"
+    char line[512], token[3][256];
+    uint32_t address;
+    while (fgets(line, sizeof(line), file))
+    {
+        int count = sscanf(line, "%255s %255s %255s", token[0], token[1], token[2]);
+        if (count == 3 && !strcmp(token[1], "=") && parseAddress(token[2], address))
+            symbols[address] = token[0];
+        else if (count == 3 && strlen(token[1]) == 1 && parseAddress(token[0], address))
+            symbols[address] = token[2];
+        else if (count == 2 && parseAddress(token[0], address))
+            symbols[address] = token[1];
+    }
+
+    fclose(file);
+    LOG_INFO("Loaded %d symbols from %s\n", (int)symbols.size(), path.c_str());
+}
+
+std::string Profiler::symbolize(uint32_t address, const std::map<uint32_t, std::string> &symbols)
+{
+    // Find the closest symbol at or below an address, and show the offset into it if it's close enough
+    auto it = symbols.upper_bound(address);
+    if (it == symbols.begin()) return "";
+    --it;
+    if (address - it->first >= SYMBOL_RANGE) return "";
+    if (address == it->first) return it->second;
+    char offset[16];
+    sprintf(offset, "+0x%X", address - it->first);
+    return it->second + offset;
+}
+
+void Profiler::writeTop(FILE *file, const std::unordered_map<uint32_t, uint64_t> &hits, uint64_t total,
+    const std::map<uint32_t, std::string> *symbols, int digits)
+{
+    // Sort the histogram entries from most to least samples
+    std::vector<std::pair<uint64_t, uint32_t>> sorted;
+    sorted.reserve(hits.size());
+    for (auto it = hits.begin(); it != hits.end(); it++)
+        sorted.push_back(std::make_pair(it->second, it->first));
+    std::sort(sorted.begin(), sorted.end(), [](const std::pair<uint64_t, uint32_t> &a,
+        const std::pair<uint64_t, uint32_t> &b) { return a.first > b.first || (a.first == b.first && a.second < b.second); });
+
+    // Write the top entries with their share of the samples
+    for (size_t i = 0; i < std::min<size_t>(sorted.size(), TOP_COUNT); i++)
+    {
+        fprintf(file, "%10llu %6.2f%%  %0*X", (unsigned long long)sorted[i].first,
+            100.0 * sorted[i].first / total, digits, sorted[i].second);
+        if (symbols && !symbols->empty())
+            fprintf(file, "  %s", symbolize(sorted[i].second, *symbols).c_str());
+        fprintf(file, "\n");
+    }
+}
+
+bool Profiler::dump(const std::string &path)
+{
+    // Check if anything was sampled this session
+    if (!cpuSamples) return false;
+    FILE *file = fopen(path.c_str(), "w");
+    if (!file) return false;
+
+    // Load symbols if a map file is set
+    std::map<uint32_t, std::string> symbols;
+    if (!Settings::profileMap.empty())
+        loadMap(Settings::profileMap, symbols);
+
+    // Write a flat profile of CPU instruction addresses
+    fprintf(file, "CPU samples: %llu, RSP samples: %llu, every %d cycles\n\n",
+        (unsigned long long)cpuSamples, (unsigned long long)rspSamples, Settings::profileInterval);
+    fprintf(file, "Top CPU addresses:\n");
+    writeTop(file, cpuHits, cpuSamples, &symbols, 8);
+
+    // Merge the addresses into the basic blocks that contain them, splitting blocks at sampled branch targets
+    std::unordered_set<uint32_t> targets;
+    std::unordered_map<uint32_t, uint64_t> blockHits;
+    uint32_t target;
+    for (auto it = cpuHits.begin(); it != cpuHits.end(); it++)
+    {
+        if (branchTarget(it->first, target))
+            targets.insert(target);
+    }
+    for (auto it = cpuHits.begin(); it != cpuHits.end(); it++)
+        blockHits[blockStart(it->first, targets)] += it->second;
+    fprintf(file, "\nTop CPU basic blocks:\n");
+    writeTop(file, blockHits, cpuSamples, &symbols, 8);
+
+    // Write how often each class of instruction was about to execute, from most to least
+    std::vector<std::pair<uint64_t, const char*>> opcodes;
+    for (auto it = opcodeHits.begin(); it != opcodeHits.end(); it++)
+        opcodes.push_back(std::make_pair(it->second, it->first));
+    std::sort(opcodes.begin(), opcodes.end(), [](const std::pair<uint64_t, const char*> &a,
+        const std::pair<uint64_t, const char*> &b) { return a.first > b.first; });
+    fprintf(file, "\nCPU opcode classes:\n");
+    for (size_t i = 0; i < opcodes.size(); i++)
+        fprintf(file, "%10llu %6.2f%%  %s\n", (unsigned long long)opcodes[i].first,
+            100.0 * opcodes[i].first / cpuSamples, opcodes[i].second);
+
+    // Write a flat profile of RSP IMEM addresses, which aren't covered by the CPU symbols
+    if (rspSamples)
+    {
+        fprintf(file, "\nTop RSP addresses:\n");
+        writeTop(file, rspHits, rspSamples, nullptr, 3);
+    }
+
+    fclose(file);
+    LOG_INFO("Wrote profile to %s\n", path.c_str());
+    return true;
+}
@@ -18,16 +18,39 @@
 */
 
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
 #include <cstring>
 #include <mutex>
 #include <thread>
 #include <vector>
 
 #include "rdp.h"
+#include "core.h"
 #include "log.h"
 #include "memory.h"
 #include "mi.h"
+#include "rdp_capture.h"
 #include "settings.h"
+#include "state.h"
+#include "trace.h"
+#include "vi.h"
+
+#define MAX_PARAMS 22
+
+// Fill-rate counting compiles away entirely unless RDP_COUNTERS is defined
+#ifdef RDP_COUNTERS
+#define OVERDRAW_SIZE 1024
+#define UNTEXTURED 20
+#define UNKNOWN_FORMAT 21
+#define TEXTURE_FORMAT(format) ((format) < UNTEXTURED ? (format) : UNKNOWN_FORMAT) // Undefined format codes share a slot
+#define COUNT_PIXEL(type, format, x, y) countPixel(type, format, x, y)
+#define COUNT_REJECTED(type, format, count) countRejected(type, format, count)
+#else
+#define COUNT_PIXEL(type, format, x, y) ((void)0)
+#define COUNT_REJECTED(type, format, count) ((void)0)
+#endif
 
 enum Format
 {
@@ -68,7 +91,10 @@ namespace RDP
 
     std::thread *thread;
     std::mutex mutex;
+    std::condition_variable workCond;
+    std::condition_variable idleCond;
     bool running;
+    bool stopping;
 
     uint8_t tmem[0x1000]; // 4KB TMEM
     uint32_t startAddr;
@@ -79,6 +105,11 @@ namespace RDP
     uint32_t addrMask;
     uint8_t paramCount;
     std::vector<uint64_t> opcode;
+    uint32_t queuedColor;
+    std::atomic<uint64_t> commandCount;
+    std::atomic<uint64_t> pixelCount;
+    std::atomic<uint64_t> execTime;
+    uint64_t inlineTime;
 
     CycleType cycleType;
     bool texFilter;
@@ -129,6 +160,24 @@ namespace RDP
     uint32_t *combineC[4];
     uint32_t *combineD[4];
 
+#ifdef RDP_COUNTERS
+    RdpCounters counters;
+    uint16_t overdraw[OVERDRAW_SIZE * OVERDRAW_SIZE];
+    int overdrawWidth;
+    int overdrawHeight;
+
+    void countPixel(RdpCounter type, int format, int x, int y);
+    void countRejected(RdpCounter type, int format, int count);
+#endif
+
+    uint32_t *combineSources[] =
+    {
+        &combColor, &texelColor, &primColor, &shadeColor, &envColor, &combAlpha,
+        &texelAlpha, &primAlpha, &shadeAlpha, &envAlpha, &maxColor, &minColor
+    };
+
+    uint8_t getSourceIndex(uint32_t *source);
+
     uint32_t RGBA16toRGBA32(uint16_t color);
     uint16_t RGBA32toRGBA16(uint32_t color);
     uint32_t colorToAlpha(uint32_t color);
@@ -139,7 +188,11 @@ namespace RDP
     bool drawPixel(int x, int y);
     bool testDepth(int x, int y, int z);
 
+    void runCommand(uint8_t op);
+    bool commandReady();
+    void startThread();
     void runThreaded();
+    void queueParam(uint64_t param);
     void runCommands();
 
     template <bool shade, bool texture, bool depth> void triangle();
@@ -198,6 +251,29 @@ uint8_t RDP::paramCounts[0x40] =
     1, 1, 1, 1, 1, 1, 1, 1 // 0x38-0x3F
 };
 
+#ifdef RDP_COUNTERS
+// Names to report fill-rate counters with
+const char *RDP::counterNames[MAX_RDP_COUNTERS] =
+{
+    "tested", "written", "z_rejected", "alpha_rejected", "scissor_rejected"
+};
+
+const char *RDP::cycleNames[RDP_CYCLE_TYPES] =
+{
+    "1cycle", "2cycle", "copy", "fill"
+};
+
+const char *RDP::formatNames[RDP_COUNTER_FORMATS] =
+{
+    "RGBA4", "RGBA8", "RGBA16", "RGBA32",
+    "YUV4", "YUV8", "YUV16", "YUV32",
+    "CI4", "CI8", "CI16", "CI32",
+    "IA4", "IA8", "IA16", "IA32",
+    "I4", "I8", "I16", "I32",
+    "none", "unknown"
+};
+#endif
+
 void RDP::reset()
 {
     // Reset the RDP to its initial state
@@ -209,6 +285,7 @@ void RDP::reset()
     addrMask = 0xFFFFFF;
     paramCount = 0;
     opcode.clear();
+    queuedColor = 0xA0000000;
     cycleType = ONE_CYCLE;
     texFilter = false;
     blendA[0] = blendA[1] = 0;
@@ -256,6 +333,173 @@ void RDP::reset()
         combineC[i] = &maxColor;
         combineD[i] = &minColor;
     }
+
+#ifdef RDP_COUNTERS
+    // Clear the fill-rate counters and overdraw
+    memset(&counters, 0, sizeof(counters));
+    clearOverdraw();
+#endif
+}
+
+void RDP::saveState(State &state)
+{
+    // Finish any threaded work so the state is consistent
+    finishThread();
+
+    // Save the RDP registers and TMEM
+    state.write(tmem);
+    state.write(startAddr);
+    state.write(endAddr);
+    state.write(status);
+    state.write(addrBase);
+    state.write(addrMask);
+
+    // Save the parameters of a partially received command, padded to a fixed size
+    uint64_t params[MAX_PARAMS] = {};
+    uint8_t count = std::min<size_t>(opcode.size(), MAX_PARAMS);
+    std::copy(opcode.begin(), opcode.begin() + count, params);
+    state.write(paramCount);
+    state.write(count);
+    state.write(params);
+
+    // Save the render modes and image settings
+    state.write(cycleType);
+    state.write(texFilter);
+    state.write(blendA);
+    state.write(blendB);
+    state.write(blendC);
+    state.write(blendD);
+    state.write(alphaMultiply);
+    state.write(zMode);
+    state.write(zUpdate);
+    state.write(zCompare);
+    state.write(alphaCompare);
+    state.write(texAddress);
+    state.write(texWidth);
+    state.write(texFormat);
+    state.write(zAddress);
+    state.write(colorAddress);
+    state.write(colorWidth);
+    state.write(colorFormat);
+    state.write(tiles);
+    state.write(scissorX1);
+    state.write(scissorX2);
+    state.write(scissorY1);
+    state.write(scissorY2);
+
+    // Save the color registers
+    state.write(fillColor);
+    state.write(combColor);
+    state.write(texelColor);
+    state.write(primColor);
+    state.write(shadeColor);
+    state.write(envColor);
+    state.write(combAlpha);
+    state.write(texelAlpha);
+    state.write(primAlpha);
+    state.write(shadeAlpha);
+    state.write(envAlpha);
+    state.write(fogColor);
+    state.write(blendColor);
+    state.write(pixelAlpha);
+    state.write(memColor);
+
+    // Save the color combiner inputs as indices into the list of sources
+    uint8_t sources[4][4];
+    for (int i = 0; i < 4; i++)
+    {
+        sources[0][i] = getSourceIndex(combineA[i]);
+        sources[1][i] = getSourceIndex(combineB[i]);
+        sources[2][i] = getSourceIndex(combineC[i]);
+        sources[3][i] = getSourceIndex(combineD[i]);
+    }
+    state.write(sources);
+}
+
+void RDP::loadState(State &state)
+{
+    // Make sure the thread isn't running before replacing the state
+    finishThread();
+
+    // Load the RDP registers and TMEM
+    state.read(tmem);
+    state.read(startAddr);
+    state.read(endAddr);
+    state.read(status);
+    state.read(addrBase);
+    state.read(addrMask);
+
+    // Load the parameters of a partially received command
+    uint64_t params[MAX_PARAMS];
+    uint8_t count;
+    state.read(paramCount);
+    state.read(count);
+    state.read(params);
+    opcode.assign(params, params + std::min<uint8_t>(count, MAX_PARAMS));
+
+    // Load the render modes and image settings
+    state.read(cycleType);
+    state.read(texFilter);
+    state.read(blendA);
+    state.read(blendB);
+    state.read(blendC);
+    state.read(blendD);
+    state.read(alphaMultiply);
+    state.read(zMode);
+    state.read(zUpdate);
+    state.read(zCompare);
+    state.read(alphaCompare);
+    state.read(texAddress);
+    state.read(texWidth);
+    state.read(texFormat);
+    state.read(zAddress);
+    state.read(colorAddress);
+    state.read(colorWidth);
+    state.read(colorFormat);
+    state.read(tiles);
+    state.read(scissorX1);
+    state.read(scissorX2);
+    state.read(scissorY1);
+    state.read(scissorY2);
+
+    // Load the color registers
+    state.read(fillColor);
+    state.read(combColor);
+    state.read(texelColor);
+    state.read(primColor);
+    state.read(shadeColor);
+    state.read(envColor);
+    state.read(combAlpha);
+    state.read(texelAlpha);
+    state.read(primAlpha);
+    state.read(shadeAlpha);
+    state.read(envAlpha);
+    state.read(fogColor);
+    state.read(blendColor);
+    state.read(pixelAlpha);
+    state.read(memColor);
+
+    // Load the color combiner inputs, falling back to zero for invalid indices
+    uint8_t sources[4][4];
+    state.read(sources);
+    const size_t total = sizeof(combineSources) / sizeof(*combineSources);
+    for (int i = 0; i < 4; i++)
+    {
+        combineA[i] = combineSources[sources[0][i] < total ? sources[0][i] : total - 1];
+        combineB[i] = combineSources[sources[1][i] < total ? sources[1][i] : total - 1];
+        combineC[i] = combineSources[sources[2][i] < total ? sources[2][i] : total - 1];
+        combineD[i] = combineSources[sources[3][i] < total ? sources[3][i] : total - 1];
+    }
+
+    // The queue is empty, so the color image being drawn to is the current one
+    queuedColor = colorAddress;
+}
+
+uint8_t RDP::getSourceIndex(uint32_t *source)
+{
+    // Find a color combiner input in the list of sources
+    const size_t count = sizeof(combineSources) / sizeof(*combineSources);
+    return std::find(combineSources, combineSources + count, source) - combineSources;
 }
 
 uint32_t RDP::read(int index)
@@ -557,6 +801,9 @@ bool RDP::blendPixel(bool cycle, uint32_t &color)
 
 bool RDP::drawPixel(int x, int y)
 {
+    // Count the pixel; only the thread running commands writes this, so no atomic add is needed
+    pixelCount.store(pixelCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
     switch (cycleType)
     {
         case ONE_CYCLE:
@@ -664,6 +911,74 @@ bool RDP::drawPixel(int x, int y)
     return false;
 }
 
+#ifdef RDP_COUNTERS
+inline void RDP::countPixel(RdpCounter type, int format, int x, int y)
+{
+    // Count a pixel that was tested along with its outcome, and track how many times each position is written
+    counters.pixels[PIXELS_TESTED][cycleType][format]++;
+    counters.pixels[type][cycleType][format]++;
+    if (type != PIXELS_WRITTEN || (uint32_t)x >= OVERDRAW_SIZE || (uint32_t)y >= OVERDRAW_SIZE)
+        return;
+    overdraw[y * OVERDRAW_SIZE + x]++;
+    overdrawWidth = std::max(overdrawWidth, x + 1);
+    overdrawHeight = std::max(overdrawHeight, y + 1);
+}
+
+inline void RDP::countRejected(RdpCounter type, int format, int count)
+{
+    // Count pixels that were rejected all at once, like a rectangle clipped to the scissor bounds
+    counters.pixels[PIXELS_TESTED][cycleType][format] += count;
+    counters.pixels[type][cycleType][format] += count;
+}
+
+void RDP::getCounters(RdpCounters &counters)
+{
+    // Get the fill-rate counter totals once queued commands are done
+    finishThread();
+    counters = RDP::counters;
+}
+
+bool RDP::writeOverdraw(const std::string &path)
+{
+    // Wait for queued commands, then write how many times each position was drawn to since the last call
+    finishThread();
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file) return false;
+
+    // Color the counts as a binary PPM image, from black for none through blue, green and yellow to red
+    static const uint8_t colors[][3] =
+    {
+        { 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0xA0 }, { 0x00, 0xA0, 0xFF }, { 0x00, 0xC0, 0x00 },
+        { 0xFF, 0xFF, 0x00 }, { 0xFF, 0x80, 0x00 }, { 0xFF, 0x00, 0x00 }, { 0xFF, 0xFF, 0xFF }
+    };
+    const int count = sizeof(colors) / sizeof(*colors);
+    int width = std::max(overdrawWidth, 1), height = std::max(overdrawHeight, 1);
+    std::vector<uint8_t> image(width * height * 3);
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+            memcpy(&image[(y * width + x) * 3], colors[std::min<int>(overdraw[y * OVERDRAW_SIZE + x], count - 1)], 3);
+    }
+
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    fwrite(image.data(), sizeof(uint8_t), image.size(), file);
+    fclose(file);
+
+    // Start counting the next frame from scratch
+    clearOverdraw();
+    return true;
+}
+
+void RDP::clearOverdraw()
+{
+    // Reset the overdraw counts once queued commands are done
+    finishThread();
+    memset(overdraw, 0, sizeof(overdraw));
+    overdrawWidth = 0;
+    overdrawHeight = 0;
+}
+#endif
+
 bool RDP::testDepth(int x, int y, int z)
 {
     // Read the existing depth value from memory
@@ -681,46 +996,101 @@ bool RDP::testDepth(int x, int y, int z)
     }
 }
 
+void RDP::getStats(CoreStats &stats)
+{
+    // Get the totals of commands run, pixels processed by drawing commands, and time spent executing
+    stats.rdpCommands = commandCount.load(std::memory_order_relaxed);
+    stats.rdpPixels = pixelCount.load(std::memory_order_relaxed);
+    stats.rdpTime = execTime.load(std::memory_order_relaxed);
+}
+
+uint64_t RDP::getInlineTime()
+{
+    // Get the time spent processing commands on the emulator thread, so it can be left out of CPU time
+    return inlineTime;
+}
+
+void RDP::runCommand(uint8_t op)
+{
+    // Execute a command, timing it if performance stats or tracing are enabled
+    // Commands can run on either thread, so the time is added atomically
+    if (!Settings::perfStats && !Settings::trace)
+        return (*commands[op])();
+    uint64_t start = Core::hostTime();
+    (*commands[op])();
+    Trace::end("RDP Command", Settings::trace ? start : 0, op);
+    if (Settings::perfStats)
+        execTime.fetch_add(Core::hostTime() - start, std::memory_order_relaxed);
+}
+
 void RDP::finishThread()
 {
-    // Stop the thread if it was running
+    // Wait for the thread to execute all of the queued commands, but keep it around for later
     if (running)
     {
-        running = false;
+        uint64_t start = Trace::begin();
+        std::unique_lock<std::mutex> lock(mutex);
+        idleCond.wait(lock, [] { return !commandReady(); });
+        Trace::end("Wait For RDP", start);
+    }
+}
+
+void RDP::stopThread()
+{
+    // Finish the queued commands and stop the thread if it was running
+    if (running)
+    {
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            stopping = true;
+            workCond.notify_one();
+        }
+
         thread->join();
         delete thread;
+        running = false;
+        stopping = false;
     }
 }
 
+bool RDP::commandReady()
+{
+    // Check if all of the parameters for the command at the front of the queue have been received
+    return !opcode.empty() && opcode.size() >= paramCounts[(opcode[0] >> 56) & 0x3F];
+}
+
 void RDP::runThreaded()
 {
+    std::unique_lock<std::mutex> lock(mutex);
+    Trace::setThreadName("RDP");
+
     while (true)
     {
-        // Parse the next command if one is queued
-        mutex.lock();
-        uint8_t op = opcode.empty() ? 0 : ((opcode[0] >> 56) & 0x3F);
-        uint8_t count = paramCounts[op];
+        // Sleep until a command is queued or the thread is stopped
+        workCond.wait(lock, [] { return stopping || commandReady(); });
 
-        if (opcode.size() >= count)
+        if (commandReady())
         {
             // Execute a command once all of its parameters have been queued
-            mutex.unlock();
-            (*commands[op])();
-            mutex.lock();
-            opcode.erase(opcode.begin(), opcode.begin() + count);
-            mutex.unlock();
+            uint8_t op = (opcode[0] >> 56) & 0x3F;
+            lock.unlock();
+            runCommand(op);
+            lock.lock();
+            opcode.erase(opcode.begin(), opcode.begin() + paramCounts[op]);
+
+            // Let waiting threads know when the queue runs dry
+            if (!commandReady())
+                idleCond.notify_all();
         }
         else
         {
-            // If requested, stop running when the queue is empty
-            mutex.unlock();
-            if (!running) return;
-            std::this_thread::yield();
+            // Stop running once everything has been executed
+            return;
         }
     }
 }
 
-void RDP::runCommands()
+void RDP::startThread()
 {
     // Start the thread if enabled and not running
     if (Settings::threadedRdp && !running)
@@ -728,37 +1098,101 @@ void RDP::runCommands()
         running = true;
         thread = new std::thread(runThreaded);
     }
+}
+
+void RDP::queueParam(uint64_t param)
+{
+    // Add a parameter to the buffer
+    opcode.push_back(param);
+    paramCount++;
+
+    // Execute a command once all of its parameters have been received
+    // When threaded, only run sync commands here; the rest will run on the thread
+    uint8_t op = (opcode[opcode.size() - paramCount] >> 56) & 0x3F;
+    if (paramCount < paramCounts[op])
+        return;
+
+    // Track the color image as commands are queued, since the thread may not have set it yet
+    paramCount = 0;
+    commandCount.store(commandCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    if (op == 0x3F) // Set Color Image
+        queuedColor = 0xA0000000 + (opcode.back() & 0xFFFFFF);
+
+    // Frameskip only drops drawing to framebuffers the VI displays, so the CPU can read back others
+    // Nothing is dropped while capturing, so a replay draws exactly what was recorded
+    bool skip = Core::skipRdp || (Core::skipFrame && VI::isDisplayed(queuedColor));
+    if (skip && !RDP_Capture::isActive() && ((op >= 0x08 && op <= 0x0F) || op == 0x24 || op == 0x36))
+    {
+        // Drop drawing commands for frames that will never be displayed
+        opcode.erase(opcode.end() - paramCounts[op], opcode.end());
+    }
+    else if (!running)
+    {
+        // Execute commands right away when not threaded
+        runCommand(op);
+        opcode.clear();
+    }
+    else if (op == 0x29) // Sync Full
+    {
+        // Wait for the thread to catch up, and then run the sync command here
+        opcode.pop_back();
+        mutex.unlock();
+        finishThread();
+        mutex.lock();
+        runCommand(op);
+    }
+    else
+    {
+        // Wake the thread to execute the command
+        workCond.notify_one();
+    }
+}
+
+void RDP::runCommands()
+{
+    // When capturing, record memory changes since the last commands so a replay sees the same data
+    bool capturing = RDP_Capture::isActive();
+    if (capturing)
+    {
+        finishThread();
+        RDP_Capture::syncMemory();
+    }
 
+    startThread();
+    uint64_t start = Settings::perfStats ? Core::hostTime() : 0;
     mutex.lock();
 
     // Process RDP commands until the end address is reached
     while (startAddr < endAddr)
     {
-        // Add a parameter to the buffer
-        opcode.push_back(Memory::read<uint64_t>(addrBase + (startAddr & addrMask)));
-        paramCount++;
-
-        // Execute a command once all of its parameters have been received
-        // When threaded, only run sync commands here; the rest will run on the thread
-        uint8_t op = (opcode[opcode.size() - paramCount] >> 56) & 0x3F;
-        if (paramCount >= paramCounts[op])
-        {
-            paramCount = 0;
-            if (!running || op == 0x29) // Sync Full
-            {
-                mutex.unlock();
-                finishThread();
-                mutex.lock();
-                (*commands[op])();
-                opcode.clear();
-            }
-        }
-
-        // Move to the next parameter
+        uint64_t param = Memory::read<uint64_t>(addrBase + (startAddr & addrMask));
+        if (capturing) RDP_Capture::recordParam(param);
+        queueParam(param);
         startAddr += 8;
     }
 
     mutex.unlock();
+
+    // Track how long the emulator thread spent here
+    if (Settings::perfStats)
+        inlineTime += Core::hostTime() - start;
+
+    // When capturing, let the commands finish so their own writes aren't recorded as memory changes
+    if (capturing)
+    {
+        finishThread();
+        RDP_Capture::updateShadow();
+    }
+}
+
+void RDP::replayParams(const uint64_t *params, size_t count)
+{
+    // Run command parameters from a capture the same way as ones read from memory
+    startThread();
+    mutex.lock();
+    for (size_t i = 0; i < count; i++)
+        queueParam(params[i]);
+    mutex.unlock();
 }
 
 template <bool shade, bool texture, bool depth> void RDP::triangle()
@@ -856,8 +1290,8 @@ template <bool shade, bool texture, bool depth> void RDP::triangle()
         for (int x = xa; x < xb; x++)
         {
             // Draw a pixel if within scissor bounds and the depth test passes
-            if (x >= scissorX1 && x < scissorX2 && y >= scissorY1 && y < scissorY2 &&
-                (!depth || !zCompare || testDepth(x, y, za >> 16)))
+            bool inside = (x >= scissorX1 && x < scissorX2 && y >= scissorY1 && y < scissorY2);
+            if (inside && (!depth || !zCompare || testDepth(x, y, za >> 16)))
             {
                 // Update the shade color for the current pixel
                 if (shade)
@@ -878,8 +1312,14 @@ template <bool shade, bool texture, bool depth> void RDP::triangle()
                 }
 
                 // Update the Z buffer if a pixel is drawn
-                if (drawPixel(x, y) && depth && zUpdate)
+                bool drawn = drawPixel(x, y);
+                if (drawn && depth && zUpdate)
                     Memory::write<uint16_t>(zAddress + (y * colorWidth + x) * 2, za >> 16);
+                COUNT_PIXEL(drawn ? PIXELS_WRITTEN : ALPHA_REJECTED, texture ? TEXTURE_FORMAT(tile->format) : UNTEXTURED, x, y);
+            }
+            else
+            {
+                COUNT_PIXEL(inside ? Z_REJECTED : SCISSOR_REJECTED, texture ? TEXTURE_FORMAT(tile->format) : UNTEXTURED, x, y);
             }
 
             // Interpolate the values across the line
@@ -927,7 +1367,14 @@ void RDP::texRectangle()
             {
                 texelColor = getTexel(tile, s >> 5, t >> 5, true);
                 texelAlpha = colorToAlpha(texelColor);
-                drawPixel(x, y);
+                if (drawPixel(x, y))
+                    COUNT_PIXEL(PIXELS_WRITTEN, TEXTURE_FORMAT(tile.format), x, y);
+                else
+                    COUNT_PIXEL(ALPHA_REJECTED, TEXTURE_FORMAT(tile.format), x, y);
+            }
+            else
+            {
+                COUNT_PIXEL(SCISSOR_REJECTED, TEXTURE_FORMAT(tile.format), x, y);
             }
         }
     }
@@ -1172,15 +1619,26 @@ void RDP::fillRectangle()
     }
 
     // Clip the coordinates to be within scissor bounds
+#ifdef RDP_COUNTERS
+    int area = std::max(x2 - x1, 0) * std::max(y2 - y1, 0);
+#endif
     x1 = std::max(x1, scissorX1);
     x2 = std::min(x2, scissorX2);
     y1 = std::max(y1, scissorY1);
     y2 = std::min(y2, scissorY2);
+    COUNT_REJECTED(SCISSOR_REJECTED, UNTEXTURED, area - std::max(x2 - x1, 0) * std::max(y2 - y1, 0));
 
     // Draw a rectangle
     for (int y = y1; y < y2; y++)
+    {
         for (int x = x1; x < x2; x++)
-            drawPixel(x, y);
+        {
+            if (drawPixel(x, y))
+                COUNT_PIXEL(PIXELS_WRITTEN, UNTEXTURED, x, y);
+            else
+                COUNT_PIXEL(ALPHA_REJECTED, UNTEXTURED, x, y);
+        }
+    }
 }
 
 void RDP::setFillColor()
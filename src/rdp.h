@@ -20,14 +20,56 @@
 #ifndef RDP_H
 #define RDP_H
 
+#include <cstddef>
 #include <cstdint>
+#include <string>
+
+struct CoreStats;
+struct State;
+
+#ifdef RDP_COUNTERS
+// Fill-rate counters, only compiled in when RDP_COUNTERS is defined so normal builds pay nothing
+enum RdpCounter
+{
+    PIXELS_TESTED = 0,
+    PIXELS_WRITTEN,
+    Z_REJECTED,
+    ALPHA_REJECTED,
+    SCISSOR_REJECTED,
+    MAX_RDP_COUNTERS
+};
+
+#define RDP_CYCLE_TYPES 4
+#define RDP_COUNTER_FORMATS 22 // Texture formats, plus untextured drawing and undefined formats
+
+struct RdpCounters
+{
+    uint64_t pixels[MAX_RDP_COUNTERS][RDP_CYCLE_TYPES][RDP_COUNTER_FORMATS];
+};
+#endif
 
 namespace RDP
 {
     void reset();
+    void saveState(State &state);
+    void loadState(State &state);
     uint32_t read(int index);
     void write(int index, uint32_t value);
+    void getStats(CoreStats &stats);
+    uint64_t getInlineTime();
+    void replayParams(const uint64_t *params, size_t count);
     void finishThread();
+    void stopThread();
+
+#ifdef RDP_COUNTERS
+    extern const char *counterNames[];
+    extern const char *cycleNames[];
+    extern const char *formatNames[];
+
+    void getCounters(RdpCounters &counters);
+    bool writeOverdraw(const std::string &path);
+    void clearOverdraw();
+#endif
 }
 
 #endif // RDP_H
@@ -0,0 +1,267 @@
+/*
+    Copyright 2022-2024 Hydr8gon
+
+    This file is part of rokuyon.
+
+    rokuyon is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    rokuyon is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with rokuyon. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstring>
+
+#include "rdp_capture.h"
+#include "core.h"
+#include "log.h"
+#include "memory.h"
+#include "rdp.h"
+#include "settings.h"
+#include "state.h"
+
+#define CAPTURE_MAGIC 0x43504452 // "RDPC"
+#define CAPTURE_VERSION 1
+#define PAGE_SIZE 0x1000
+
+// A capture starts with a header and the RDP state, followed by records that are replayed in order
+// Everything is host byte order and padded to 8 bytes, so a loaded capture can be used in place
+enum RecordType
+{
+    RECORD_PAGES = 1, // Pages of RDRAM changed outside the RDP, as a page index and its data
+    RECORD_PARAMS,    // Command parameters, in the order the RDP received them
+    RECORD_FRAME      // End of a frame, with a hash of RDRAM to compare against
+};
+
+namespace RDP_Capture
+{
+    FILE *file;
+    std::vector<uint8_t> shadow;
+    std::vector<uint64_t> params;
+
+    void writeRecord(uint32_t type, uint32_t count);
+    void flushParams();
+}
+
+bool RDP_Capture::start(const std::string &path)
+{
+    // Open the capture file, ending any capture in progress
+    stop();
+    file = fopen(path.c_str(), "wb");
+    if (!file) return false;
+
+    // Save the RDP state, including TMEM, that the first commands will start from
+    State measure(nullptr, 0);
+    RDP::saveState(measure);
+    std::vector<uint8_t> state((measure.offset + 7) & ~7);
+    State rdpState(state.data(), state.size());
+    RDP::saveState(rdpState);
+
+    // Write the header and state, along with the settings that affect rendering
+    uint32_t header[6] = { CAPTURE_MAGIC, CAPTURE_VERSION, Memory::ramSize,
+        (uint32_t)Settings::texFilter, (uint32_t)measure.offset, 0 };
+    fwrite(header, sizeof(uint32_t), 6, file);
+    fwrite(state.data(), sizeof(uint8_t), state.size(), file);
+
+    // Record the parts of RDRAM that aren't zero, since a replay starts from cleared memory
+    shadow.assign(Memory::ramSize, 0);
+    syncMemory();
+    LOG_INFO("Started RDP capture to %s\n", path.c_str());
+    return true;
+}
+
+void RDP_Capture::stop()
+{
+    // Write anything left and close the capture file
+    if (!file) return;
+    flushParams();
+    fclose(file);
+    file = nullptr;
+    shadow.clear();
+    shadow.shrink_to_fit();
+}
+
+bool RDP_Capture::isActive()
+{
+    // Check if commands are being captured
+    return file != nullptr;
+}
+
+void RDP_Capture::writeRecord(uint32_t type, uint32_t count)
+{
+    // Write the header of a record, which is followed by its data
+    uint32_t header[2] = { type, count };
+    fwrite(header, sizeof(uint32_t), 2, file);
+}
+
+void RDP_Capture::flushParams()
+{
+    // Write the command parameters received since memory was last synced
+    if (params.empty()) return;
+    writeRecord(RECORD_PARAMS, params.size());
+    fwrite(params.data(), sizeof(uint64_t), params.size(), file);
+    params.clear();
+}
+
+void RDP_Capture::syncMemory()
+{
+    // Find the pages of RDRAM that changed since the RDP last ran, which means something else wrote them
+    if (!file) return;
+    std::vector<uint32_t> pages;
+    for (uint32_t i = 0; i < Memory::ramSize; i += PAGE_SIZE)
+    {
+        if (memcmp(&Memory::rdram[i], &shadow[i], PAGE_SIZE))
+            pages.push_back(i / PAGE_SIZE);
+    }
+
+    // Record the changed pages after the commands that came before them
+    flushParams();
+    if (pages.empty()) return;
+    writeRecord(RECORD_PAGES, pages.size());
+    for (size_t i = 0; i < pages.size(); i++)
+    {
+        uint64_t page = pages[i];
+        fwrite(&page, sizeof(uint64_t), 1, file);
+        fwrite(&Memory::rdram[page * PAGE_SIZE], sizeof(uint8_t), PAGE_SIZE, file);
+        memcpy(&shadow[page * PAGE_SIZE], &Memory::rdram[page * PAGE_SIZE], PAGE_SIZE);
+    }
+}
+
+void RDP_Capture::updateShadow()
+{
+    // Take in the RDP's own writes, which a replay will reproduce without them being recorded
+    if (!file) return;
+    memcpy(shadow.data(), Memory::rdram, shadow.size());
+}
+
+void RDP_Capture::recordParam(uint64_t param)
+{
+    // Queue a command parameter to be written with the rest of its batch
+    params.push_back(param);
+}
+
+void RDP_Capture::markFrame()
+{
+    // Bring the capture up to date at the end of a frame, and record what RDRAM should look like
+    if (!file) return;
+    RDP::finishThread();
+    syncMemory();
+    uint64_t hash = hashMemory();
+    writeRecord(RECORD_FRAME, 0);
+    fwrite(&hash, sizeof(uint64_t), 1, file);
+}
+
+uint64_t RDP_Capture::hashMemory()
+{
+    // Hash all of RDRAM 8 bytes at a time, which covers every color and Z buffer the RDP could draw to
+    uint64_t hash = 0xCBF29CE484222325;
+    for (uint32_t i = 0; i < Memory::ramSize; i += 8)
+    {
+        uint64_t value;
+        memcpy(&value, &Memory::rdram[i], sizeof(value));
+        hash = (hash ^ value) * 0x100000001B3;
+    }
+    return hash;
+}
+
+bool RDP_Capture::replay(const std::vector<uint8_t> &data, ReplayStats &stats, std::vector<uint64_t> *hashes)
+{
+    // Check that the capture has a valid header and an RDP state that fits this build
+    memset(&stats, 0, sizeof(stats));
+    uint32_t header[6];
+    if (data.size() < sizeof(header)) return false;
+    memcpy(header, data.data(), sizeof(header));
+    State measure(nullptr, 0);
+    RDP::saveState(measure);
+
+    if (header[0] != CAPTURE_MAGIC || header[1] != CAPTURE_VERSION || header[4] != measure.offset)
+    {
+        LOG_WARN("RDP capture has an unsupported format or version\n");
+        return false;
+    }
+
+    size_t offset = sizeof(header) + ((header[4] + 7) & ~7);
+    if (offset > data.size()) return false;
+
+    // Set up memory and the RDP the way they were when capturing started
+    RDP::stopThread();
+    Settings::expansionPak = (header[2] > 0x400000);
+    Settings::texFilter = header[3];
+    Memory::reset();
+    RDP::reset();
+    State rdpState((uint8_t*)&data[sizeof(header)], header[4]);
+    RDP::loadState(rdpState);
+
+    bool valid = true;
+    while (valid && offset + 8 <= data.size())
+    {
+        // Read the next record header
+        uint32_t type, count;
+        memcpy(&type, &data[offset + 0], sizeof(uint32_t));
+        memcpy(&count, &data[offset + 4], sizeof(uint32_t));
+        offset += 8;
+
+        switch (type)
+        {
+            case RECORD_PAGES:
+                // Apply changes from outside the RDP once the commands before them are done
+                if (offset + (size_t)count * (8 + PAGE_SIZE) > data.size()) { valid = false; break; }
+                RDP::finishThread();
+                for (uint32_t i = 0; i < count; i++)
+                {
+                    uint64_t page;
+                    memcpy(&page, &data[offset], sizeof(uint64_t));
+                    if (page < Memory::ramSize / PAGE_SIZE)
+                        memcpy(&Memory::rdram[page * PAGE_SIZE], &data[offset + 8], PAGE_SIZE);
+                    offset += 8 + PAGE_SIZE;
+                }
+                stats.pageBytes += (uint64_t)count * PAGE_SIZE;
+                break;
+
+            case RECORD_PARAMS:
+            {
+                // Run the command parameters, timing only the RDP's work
+                if (offset + (size_t)count * 8 > data.size()) { valid = false; break; }
+                uint64_t start = Core::hostTime();
+                RDP::replayParams((const uint64_t*)&data[offset], count);
+                stats.rdpTime += Core::hostTime() - start;
+                stats.params += count;
+                offset += (size_t)count * 8;
+                break;
+            }
+
+            case RECORD_FRAME:
+            {
+                // Wait for the frame's commands to finish, then compare RDRAM with how it looked when captured
+                if (offset + 8 > data.size()) { valid = false; break; }
+                uint64_t start = Core::hostTime();
+                RDP::finishThread();
+                stats.rdpTime += Core::hostTime() - start;
+                uint64_t expected, hash = hashMemory();
+                memcpy(&expected, &data[offset], sizeof(uint64_t));
+                offset += 8;
+                if (hashes) hashes->push_back(hash);
+                stats.mismatches += (hash != expected);
+                stats.frames++;
+                break;
+            }
+
+            default:
+                valid = false;
+                break;
+        }
+    }
+
+    // Finish up, and complain if the capture was cut off or corrupted
+    RDP::stopThread();
+    if (!valid) LOG_WARN("RDP capture ended with an invalid record\n");
+    return valid;
+}
@@ -0,0 +1,51 @@
+/*
+    Copyright 2022-2024 Hydr8gon
+
+    This file is part of rokuyon.
+
+    rokuyon is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    rokuyon is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with rokuyon. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RDP_CAPTURE_H
+#define RDP_CAPTURE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct ReplayStats
+{
+    uint32_t frames;
+    uint32_t mismatches;
+    uint64_t params;
+    uint64_t pageBytes;
+    uint64_t rdpTime;
+};
+
+namespace RDP_Capture
+{
+    bool start(const std::string &path);
+    void stop();
+    bool isActive();
+
+    void syncMemory();
+    void updateShadow();
+    void recordParam(uint64_t param);
+    void markFrame();
+    uint64_t hashMemory();
+
+    bool replay(const std::vector<uint8_t> &data, ReplayStats &stats, std::vector<uint64_t> *hashes = nullptr);
+}
+
+#endif // RDP_CAPTURE_H
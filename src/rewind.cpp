@@ -0,0 +1,271 @@
+/*
+    Copyright 2022-2024 Hydr8gon
+
+    This file is part of rokuyon.
+
+    rokuyon is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    rokuyon is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with rokuyon. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+#include "rewind.h"
+#include "core.h"
+#include "log.h"
+#include "memory.h"
+#include "rdp.h"
+#include "settings.h"
+
+#define PAGE_SIZE 0x1000
+
+namespace Rewind
+{
+    // The newest snapshot is kept in full, and each delta turns a snapshot into the one before it
+    std::vector<uint8_t> latest;
+    std::vector<uint8_t> current;
+    std::deque<std::vector<uint8_t>> deltas;
+    size_t deltaBytes;
+    size_t ramOffset;
+    size_t ramSize;
+    int frameCount;
+
+    std::atomic<bool> active;
+    std::atomic<uint32_t> snapshots;
+    std::atomic<size_t> memoryUsage;
+    std::atomic<size_t> historyBytes;
+    std::atomic<float> captureTime;
+
+    void writeVarint(std::vector<uint8_t> &out, size_t value);
+    size_t readVarint(const uint8_t *&data);
+    void encode(std::vector<uint8_t> &out, const uint8_t *cur, const uint8_t *old, size_t size);
+    void decode(uint8_t *dst, const std::vector<uint8_t> &delta);
+
+    void capture();
+    void restore();
+}
+
+RewindStats Rewind::getStats()
+{
+    // Get the current rewind history metrics
+    RewindStats stats;
+    stats.snapshots = snapshots.load(std::memory_order_relaxed);
+    stats.seconds = (float)stats.snapshots * std::max(1, Settings::rewindInterval) / 60;
+    stats.memoryUsage = memoryUsage.load(std::memory_order_relaxed);
+    stats.bytesPerSecond = stats.seconds ? historyBytes.load(std::memory_order_relaxed) / stats.seconds : 0;
+    stats.captureTime = captureTime.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void Rewind::setActive(bool active)
+{
+    // Start or stop rewinding at the next frame
+    Rewind::active.store(active, std::memory_order_relaxed);
+}
+
+void Rewind::reset()
+{
+    // Clear the rewind history
+    std::vector<uint8_t>().swap(latest);
+    std::vector<uint8_t>().swap(current);
+    deltas.clear();
+    deltaBytes = 0;
+    frameCount = 0;
+    snapshots.store(0);
+    memoryUsage.store(0);
+    historyBytes.store(0);
+    captureTime.store(0);
+}
+
+void Rewind::update()
+{
+    // Step back through the history every frame while rewinding, or capture a snapshot every few frames
+    if (active.load(std::memory_order_relaxed))
+        return restore();
+    if (++frameCount >= Settings::rewindInterval)
+    {
+        frameCount = 0;
+        capture();
+    }
+}
+
+void Rewind::writeVarint(std::vector<uint8_t> &out, size_t value)
+{
+    // Write a value 7 bits at a time, with the top bit set if more follow
+    while (value >= 0x80)
+    {
+        out.push_back((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(value);
+}
+
+size_t Rewind::readVarint(const uint8_t *&data)
+{
+    // Read a value 7 bits at a time until the top bit is clear
+    size_t value = 0;
+    for (int shift = 0; ; shift += 7)
+    {
+        uint8_t byte = *data++;
+        value |= (size_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return value;
+    }
+}
+
+void Rewind::encode(std::vector<uint8_t> &out, const uint8_t *cur, const uint8_t *old, size_t size)
+{
+    // Compress the XOR of 2 snapshots as runs of unchanged bytes, each followed by a run of changed ones
+    // RDRAM pages that haven't been written since the last snapshot are skipped without comparing
+    size_t i = 0, zeros = 0;
+    while (i < size)
+    {
+        // Get the end of the current segment, which is the next RDRAM page boundary if inside RDRAM
+        size_t end = size;
+        if (i < ramOffset)
+        {
+            end = ramOffset;
+        }
+        else if (i < ramOffset + ramSize)
+        {
+            uint32_t page = (i - ramOffset) / PAGE_SIZE;
+            end = ramOffset + (page + 1) * PAGE_SIZE;
+            if (!(Memory::dirtyPages[page >> 5].load(std::memory_order_relaxed) & (1 << (page & 0x1F))))
+            {
+                zeros += end - i;
+                i = end;
+                continue;
+            }
+        }
+
+        while (i < end)
+        {
+            // Extend the run of unchanged bytes, comparing 8 at a time where possible
+            size_t start = i;
+            while (i + 8 <= end && !memcmp(&cur[i], &old[i], 8))
+                i += 8;
+            while (i < end && cur[i] == old[i])
+                i++;
+            zeros += i - start;
+            if (i == end) break;
+
+            // Collect changed bytes until there are 8 unchanged ones in a row
+            start = i;
+            while (i < end)
+            {
+                if (cur[i] != old[i])
+                {
+                    i++;
+                    continue;
+                }
+                size_t j = i;
+                while (j < end && j < i + 8 && cur[j] == old[j])
+                    j++;
+                if (j == end || j == i + 8) break;
+                i = j;
+            }
+
+            // Write the run lengths followed by the XORed changed bytes
+            writeVarint(out, zeros);
+            writeVarint(out, i - start);
+            for (size_t j = start; j < i; j++)
+                out.push_back(cur[j] ^ old[j]);
+            zeros = 0;
+        }
+    }
+}
+
+void Rewind::decode(uint8_t *dst, const std::vector<uint8_t> &delta)
+{
+    // Apply a delta by XORing its changed bytes back into a snapshot
+    const uint8_t *data = delta.data();
+    const uint8_t *end = data + delta.size();
+    size_t offset = 0;
+    while (data < end)
+    {
+        offset += readVarint(data);
+        size_t count = readVarint(data);
+        for (size_t i = 0; i < count; i++)
+            dst[offset++] ^= *data++;
+    }
+}
+
+void Rewind::capture()
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // Let the RDP thread finish, so no page can be written between saving the state and clearing its dirty bits
+    RDP::finishThread();
+
+    // Start a new history if there isn't one, or if the state layout changed
+    size_t size = Core::stateSize();
+    if (latest.size() != size)
+    {
+        reset();
+        latest.resize(size);
+        current.resize(size);
+        ramOffset = Core::stateRamOffset();
+        ramSize = Memory::ramSize;
+        Core::saveState(latest.data(), size);
+        Memory::setDirty(false);
+        return;
+    }
+
+    // Capture the current state and store the delta that leads back to the previous one
+    Core::saveState(current.data(), size);
+    deltas.push_back(std::vector<uint8_t>());
+    encode(deltas.back(), current.data(), latest.data(), size);
+    deltas.back().shrink_to_fit();
+    deltaBytes += deltas.back().size();
+    latest.swap(current);
+    Memory::setDirty(false);
+
+    // Drop the oldest deltas once the history uses too much memory
+    size_t limit = (size_t)std::max(1, Settings::rewindSize) << 20;
+    while (!deltas.empty() && deltaBytes + size * 2 > limit)
+    {
+        deltaBytes -= deltas.front().size();
+        deltas.pop_front();
+    }
+
+    // Update the statistics, averaging the capture time over recent snapshots and spreading it across frames
+    float time = std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - start).count();
+    float perFrame = time / std::max(1, Settings::rewindInterval);
+    float average = captureTime.load(std::memory_order_relaxed);
+    captureTime.store(average ? (average * 15 + perFrame) / 16 : perFrame, std::memory_order_relaxed);
+    snapshots.store(deltas.size(), std::memory_order_relaxed);
+    memoryUsage.store(deltaBytes + size * 2, std::memory_order_relaxed);
+    historyBytes.store(deltaBytes, std::memory_order_relaxed);
+}
+
+void Rewind::restore()
+{
+    // Step back to the previous snapshot if there is one, and load it
+    if (latest.empty()) return;
+    if (!deltas.empty())
+    {
+        decode(latest.data(), deltas.back());
+        deltaBytes -= deltas.back().size();
+        deltas.pop_back();
+    }
+    Core::loadState(latest.data(), latest.size());
+
+    // The emulator now matches the newest snapshot, so no pages are dirty
+    Memory::setDirty(false);
+    snapshots.store(deltas.size(), std::memory_order_relaxed);
+    memoryUsage.store(deltaBytes + latest.size() * 2, std::memory_order_relaxed);
+    historyBytes.store(deltaBytes, std::memory_order_relaxed);
+}
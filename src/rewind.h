@@ -0,0 +1,44 @@
+/*
+    Copyright 2022-2024 Hydr8gon
+
+    This file is part of rokuyon.
+
+    rokuyon is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    rokuyon is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with rokuyon. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <cstddef>
+#include <cstdint>
+
+struct RewindStats
+{
+    uint32_t snapshots;
+    float seconds;
+    size_t memoryUsage;
+    float bytesPerSecond;
+    float captureTime;
+};
+
+namespace Rewind
+{
+    RewindStats getStats();
+    void setActive(bool active);
+
+    void reset();
+    void update();
+}
+
+#endif // REWIND_H
@@ -25,6 +25,7 @@
 #include "memory.h"
 #include "rsp_cp0.h"
 #include "rsp_cp2.h"
+#include "state.h"
 
 namespace RSP
 {
@@ -163,6 +164,22 @@ void RSP::reset()
     setState(true);
 }
 
+void RSP::saveState(State &state)
+{
+    // Save the RSP registers and pipeline state
+    state.write(registersR);
+    state.write(programCounter);
+    state.write(nextOpcode);
+}
+
+void RSP::loadState(State &state)
+{
+    // Load the RSP registers and pipeline state
+    state.read(registersR);
+    state.read(programCounter);
+    state.read(nextOpcode);
+}
+
 uint32_t RSP::readPC()
 {
     // Get the effective bits of the RSP program counter
@@ -22,9 +22,13 @@
 
 #include <cstdint>
 
+struct State;
+
 namespace RSP
 {
     void reset();
+    void saveState(State &state);
+    void loadState(State &state);
     uint32_t readPC();
     void writePC(uint32_t value);
     void setState(bool halted);
@@ -17,12 +17,16 @@
     along with rokuyon. If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+
 #include "rsp_cp0.h"
+#include "core.h"
+#include "dma.h"
 #include "log.h"
-#include "memory.h"
 #include "mi.h"
 #include "rdp.h"
 #include "rsp.h"
+#include "state.h"
 
 namespace RSP_CP0
 {
@@ -30,9 +34,12 @@ namespace RSP_CP0
     uint32_t dramAddr;
     uint32_t status;
     uint32_t semaphore;
+    uint32_t dmaCount;
+    uint32_t dmaEnd;
 
     void performReadDma(uint32_t length, uint32_t count, uint32_t skip);
     void performWriteDma(uint32_t length, uint32_t count, uint32_t skip);
+    void startDma(uint32_t size);
 }
 
 void RSP_CP0::reset()
@@ -42,6 +49,30 @@ void RSP_CP0::reset()
     dramAddr = 0;
     status = 0x1;
     semaphore = 0;
+    dmaCount = 0;
+    dmaEnd = 0;
+}
+
+void RSP_CP0::saveState(State &state)
+{
+    // Save the RSP CP0 registers and DMA state
+    state.write(memAddr);
+    state.write(dramAddr);
+    state.write(status);
+    state.write(semaphore);
+    state.write(dmaCount);
+    state.write(dmaEnd);
+}
+
+void RSP_CP0::loadState(State &state)
+{
+    // Load the RSP CP0 registers and DMA state
+    state.read(memAddr);
+    state.read(dramAddr);
+    state.read(status);
+    state.read(semaphore);
+    state.read(dmaCount);
+    state.read(dmaEnd);
 }
 
 uint32_t RSP_CP0::read(int index)
@@ -50,8 +81,16 @@ uint32_t RSP_CP0::read(int index)
     switch (index)
     {
         case 4: // SP_STATUS
-            // Get the status register
-            return status;
+            // Get the status register, with the DMA busy and full bits
+            return status | (dmaCount > 0 ? 0x4 : 0) | (dmaCount > 1 ? 0x8 : 0);
+
+        case 5: // SP_DMA_FULL
+            // Get whether a DMA is queued behind the current one
+            return dmaCount > 1;
+
+        case 6: // SP_DMA_BUSY
+            // Get whether a DMA is in progress
+            return dmaCount > 0;
 
         case 7: // SP_SEMAPHORE
         {
@@ -159,19 +198,20 @@ void RSP_CP0::performReadDma(uint32_t length, uint32_t count, uint32_t skip)
     LOG_INFO("RSP DMA from RDRAM 0x%X to RSP MEM 0x%X with length 0x%X, "
         "count 0x%X, skip 0x%X\n", dramAddr, memAddr, length, count, skip);
 
-    // Copy rows of data from memory to the RSP
+    // Copy rows of data from memory to the RSP, splitting them if the RDRAM address wraps around
     uint32_t dramBase = dramAddr, memBase = memAddr;
     for (uint32_t c = 0; c <= count; c++)
     {
-        for (uint32_t l = 0; l <= length; l += 8)
-        {
-            uint32_t dst = 0x84000000 + ((memBase + l) & 0x1FF8);
-            uint32_t src = 0x80000000 + ((dramBase + l) & 0xFFFFF8);
-            Memory::write<uint64_t>(dst, Memory::read<uint64_t>(src));
-        }
+        uint32_t mem = 0x4000000 + (memBase & 0x1FF8);
+        uint32_t dram = dramBase & 0xFFFFF8;
+        uint32_t size = std::min(length + 8, 0x1000000 - dram);
+        DMA::copy(mem, dram, size);
+        DMA::copy(mem + size, 0, length + 8 - size);
         dramBase += length + skip + 8;
         memBase += length + 8;
     }
+
+    startDma((length + 8) * (count + 1));
 }
 
 void RSP_CP0::performWriteDma(uint32_t length, uint32_t count, uint32_t skip)
@@ -179,17 +219,42 @@ void RSP_CP0::performWriteDma(uint32_t length, uint32_t count, uint32_t skip)
     LOG_INFO("RSP DMA from RSP MEM 0x%X to RDRAM 0x%X with length 0x%X, "
         "count 0x%X, skip 0x%X\n", memAddr, dramAddr, length, count, skip);
 
-    // Copy rows of data from the RSP to memory
+    // Copy rows of data from the RSP to memory, splitting them if the RDRAM address wraps around
     uint32_t dramBase = dramAddr, memBase = memAddr;
     for (uint32_t c = 0; c <= count; c++)
     {
-        for (uint32_t l = 0; l <= length; l += 8)
-        {
-            uint32_t dst = 0x80000000 + ((dramBase + l) & 0xFFFFF8);
-            uint32_t src = 0x84000000 + ((memBase + l) & 0x1FF8);
-            Memory::write<uint64_t>(dst, Memory::read<uint64_t>(src));
-        }
+        uint32_t mem = 0x4000000 + (memBase & 0x1FF8);
+        uint32_t dram = dramBase & 0xFFFFF8;
+        uint32_t size = std::min(length + 8, 0x1000000 - dram);
+        DMA::copy(dram, mem, size);
+        DMA::copy(0, mem + size, length + 8 - size);
         dramBase += length + skip + 8;
         memBase += length + 8;
     }
+
+    startDma((length + 8) * (count + 1));
+}
+
+void RSP_CP0::startDma(uint32_t size)
+{
+    // Schedule the end of a DMA based on its size, or do nothing if timing is disabled
+    // A DMA started while another is busy gets queued, so it runs for its own length once the current one ends
+    if (uint32_t cycles = DMA::getCycles(DMA_SP, size))
+    {
+        dmaEnd = (dmaCount++ ? dmaEnd : Core::globalCycles) + cycles;
+        Core::schedule(SP_FINISH_DMA, dmaEnd - Core::globalCycles);
+    }
+}
+
+void RSP_CP0::resetCycles()
+{
+    // Adjust the end of the queued DMAs for a cycle reset
+    dmaEnd -= Core::globalCycles;
+}
+
+void RSP_CP0::finishDma()
+{
+    // Clear the busy or full state when a DMA finishes
+    if (dmaCount > 0)
+        dmaCount--;
 }
@@ -22,12 +22,18 @@
 
 #include <cstdint>
 
+struct State;
+
 namespace RSP_CP0
 {
     void reset();
+    void saveState(State &state);
+    void loadState(State &state);
     uint32_t read(int index);
     void write(int index, uint32_t value);
     void triggerBreak();
+    void resetCycles();
+    void finishDma();
 }
 
 #endif // RSP_CP0_H
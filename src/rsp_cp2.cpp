@@ -23,6 +23,7 @@
 #include "rsp_cp2.h"
 #include "log.h"
 #include "rsp.h"
+#include "state.h"
 
 namespace RSP_CP2
 {
@@ -271,6 +272,30 @@ void RSP_CP2::reset()
     vce = 0;
 }
 
+void RSP_CP2::saveState(State &state)
+{
+    // Save the RSP CP2 registers and accumulator
+    state.write(registers);
+    state.write(accumulator);
+    state.write(divIn);
+    state.write(divOut);
+    state.write(vco);
+    state.write(vcc);
+    state.write(vce);
+}
+
+void RSP_CP2::loadState(State &state)
+{
+    // Load the RSP CP2 registers and accumulator
+    state.read(registers);
+    state.read(accumulator);
+    state.read(divIn);
+    state.read(divOut);
+    state.read(vco);
+    state.read(vcc);
+    state.read(vce);
+}
+
 int16_t RSP_CP2::read(bool control, int index, int byte)
 {
     if (!control)
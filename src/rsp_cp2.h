@@ -22,11 +22,15 @@
 
 #include <cstdint>
 
+struct State;
+
 namespace RSP_CP2
 {
     extern void (*vecInstrs[])(uint32_t);
 
     void reset();
+    void saveState(State &state);
+    void loadState(State &state);
     int16_t read(bool control, int index, int byte);
     void write(bool control, int index, int byte, int16_t value);
 }
@@ -38,13 +38,51 @@ namespace Settings
     int expansionPak = 1;
     int threadedRdp = 0;
     int texFilter = 1;
+    int audioQuality = 2;
+    int dynamicRate = 1;
+    int dmaTiming = 1;
+    int dmaPiCycles = 18;
+    int dmaSiCycles = 0x1200;
+    int dmaSpBytes = 8;
+    int mmapSaves = 0;
+    int rewind = 0;
+    int rewindInterval = 2;
+    int rewindSize = 128;
+    int instantResume = 0;
+    int framesAhead = 2;
+    int frameskip = 0;
+    int frameskipInterval = 1;
+    int perfStats = 0;
+    int trace = 0;
+    int profiler = 0;
+    int profileInterval = 4096;
+    std::string profileMap = "";
 
     std::vector<Setting> settings =
     {
         Setting("fpsLimiter", &fpsLimiter, false),
         Setting("expansionPak", &expansionPak, false),
         Setting("threadedRdp", &threadedRdp, false),
-        Setting("texFilter", &texFilter, false)
+        Setting("texFilter", &texFilter, false),
+        Setting("audioQuality", &audioQuality, false),
+        Setting("dynamicRate", &dynamicRate, false),
+        Setting("dmaTiming", &dmaTiming, false),
+        Setting("dmaPiCycles", &dmaPiCycles, false),
+        Setting("dmaSiCycles", &dmaSiCycles, false),
+        Setting("dmaSpBytes", &dmaSpBytes, false),
+        Setting("mmapSaves", &mmapSaves, false),
+        Setting("rewind", &rewind, false),
+        Setting("rewindInterval", &rewindInterval, false),
+        Setting("rewindSize", &rewindSize, false),
+        Setting("instantResume", &instantResume, false),
+        Setting("framesAhead", &framesAhead, false),
+        Setting("frameskip", &frameskip, false),
+        Setting("frameskipInterval", &frameskipInterval, false),
+        Setting("perfStats", &perfStats, false),
+        Setting("trace", &trace, false),
+        Setting("profiler", &profiler, false),
+        Setting("profileInterval", &profileInterval, false),
+        Setting("profileMap", &profileMap, true)
     };
 }
 
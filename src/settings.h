@@ -32,6 +32,25 @@ namespace Settings
     extern int expansionPak;
     extern int threadedRdp;
     extern int texFilter;
+    extern int audioQuality;
+    extern int dynamicRate;
+    extern int dmaTiming;
+    extern int dmaPiCycles;
+    extern int dmaSiCycles;
+    extern int dmaSpBytes;
+    extern int mmapSaves;
+    extern int rewind;
+    extern int rewindInterval;
+    extern int rewindSize;
+    extern int instantResume;
+    extern int framesAhead;
+    extern int frameskip;
+    extern int frameskipInterval;
+    extern int perfStats;
+    extern int trace;
+    extern int profiler;
+    extern int profileInterval;
+    extern std::string profileMap;
 }
 
 #endif // SETTINGS_H
@@ -18,23 +18,42 @@
 */
 
 #include "si.h"
+#include "core.h"
+#include "dma.h"
 #include "log.h"
-#include "memory.h"
 #include "mi.h"
 #include "pif.h"
+#include "state.h"
 
 namespace SI
 {
     uint32_t dramAddr;
+    bool dmaBusy;
 
     void performReadDma(uint32_t address);
     void performWriteDma(uint32_t address);
+    void startDma();
 }
 
 void SI::reset()
 {
     // Reset the SI to its initial state
     dramAddr = 0;
+    dmaBusy = false;
+}
+
+void SI::saveState(State &state)
+{
+    // Save the SI registers and DMA state
+    state.write(dramAddr);
+    state.write(dmaBusy);
+}
+
+void SI::loadState(State &state)
+{
+    // Load the SI registers and DMA state
+    state.read(dramAddr);
+    state.read(dmaBusy);
 }
 
 uint32_t SI::read(uint32_t address)
@@ -42,6 +61,10 @@ uint32_t SI::read(uint32_t address)
     // Read from an I/O register if one exists at the given address
     switch (address)
     {
+        case 0x4800018: // SI_STATUS
+            // Get the DMA busy and interrupt bits
+            return (dmaBusy ? 0x1 : 0) | ((MI::interrupt & (1 << 1)) ? 0x1000 : 0);
+
         default:
             LOG_WARN("Unknown SI register read: 0x%X\n", address);
             return 0;
@@ -81,6 +104,13 @@ void SI::write(uint32_t address, uint32_t value)
 
 void SI::performReadDma(uint32_t address)
 {
+    // Ignore DMAs started while one is in progress, since the hardware does
+    if (dmaBusy)
+    {
+        LOG_WARN("SI DMA started while busy\n");
+        return;
+    }
+
     LOG_INFO("SI DMA from PIF 0x%X to RDRAM 0x%X with size 0x40\n", address, dramAddr);
 
     // Re-trigger the last PIF command on DMA reads
@@ -88,29 +118,42 @@ void SI::performReadDma(uint32_t address)
     PIF::runCommand();
 
     // Copy 64 bytes from PIF RAM to RDRAM
-    for (uint32_t i = 0; i < 0x40; i++)
-    {
-        uint8_t value = Memory::read<uint8_t>(0x9FC00000 + address + i);
-        Memory::write<uint8_t>(0x80000000 + dramAddr + i, value);
-    }
-
-    // Request an SI interrupt when the DMA finishes
-    // TODO: make DMAs not instant
-    MI::setInterrupt(1);
+    DMA::copy(dramAddr, 0x1FC00000 + address, 0x40);
+    startDma();
 }
 
 void SI::performWriteDma(uint32_t address)
 {
+    // Ignore DMAs started while one is in progress, since the hardware does
+    if (dmaBusy)
+    {
+        LOG_WARN("SI DMA started while busy\n");
+        return;
+    }
+
     LOG_INFO("SI DMA from RDRAM 0x%X to PIF 0x%X with size 0x40\n", dramAddr, address);
 
     // Copy 64 bytes from RDRAM to PIF RAM
-    for (uint32_t i = 0; i < 0x40; i++)
+    DMA::copy(0x1FC00000 + address, dramAddr, 0x40);
+    startDma();
+}
+
+void SI::startDma()
+{
+    // Schedule the end of a DMA, or finish it right away if timing is disabled
+    if (uint32_t cycles = DMA::getCycles(DMA_SI, 0x40))
     {
-        uint8_t value = Memory::read<uint8_t>(0x80000000 + dramAddr + i);
-        Memory::write<uint8_t>(0x9FC00000 + address + i, value);
+        dmaBusy = true;
+        Core::schedule(SI_FINISH_DMA, cycles);
+        return;
     }
 
-    // Request an SI interrupt when the DMA finishes
-    // TODO: make DMAs not instant
+    finishDma();
+}
+
+void SI::finishDma()
+{
+    // Clear the busy bit and request an SI interrupt when a DMA finishes
+    dmaBusy = false;
     MI::setInterrupt(1);
 }
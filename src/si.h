@@ -22,11 +22,17 @@
 
 #include <cstdint>
 
+struct State;
+
 namespace SI
 {
     void reset();
+    void saveState(State &state);
+    void loadState(State &state);
     uint32_t read(uint32_t address);
     void write(uint32_t address, uint32_t value);
+
+    void finishDma();
 }
 
 #endif // SI_H
@@ -0,0 +1,62 @@
+/*
+    Copyright 2022-2024 Hydr8gon
+
+    This file is part of rokuyon.
+
+    rokuyon is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    rokuyon is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with rokuyon. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef STATE_H
+#define STATE_H
+
+#include <cstdint>
+#include <cstring>
+
+// Cursor for reading and writing fixed-layout save state data
+// Writing with a null buffer just counts the size, which is used to measure a state
+struct State
+{
+    State(uint8_t *data, size_t size):
+        data(data), size(size), offset(0) {}
+
+    uint8_t *data;
+    size_t size;
+    size_t offset;
+
+    void write(const void *value, size_t count)
+    {
+        if (data && offset + count <= size)
+            memcpy(&data[offset], value, count);
+        offset += count;
+    }
+
+    void fill(uint8_t value, size_t count)
+    {
+        if (data && offset + count <= size)
+            memset(&data[offset], value, count);
+        offset += count;
+    }
+
+    void read(void *value, size_t count)
+    {
+        if (offset + count <= size)
+            memcpy(value, &data[offset], count);
+        offset += count;
+    }
+
+    template <typename T> void write(const T &value) { write(&value, sizeof(T)); }
+    template <typename T> void read(T &value) { read(&value, sizeof(T)); }
+};
+
+#endif // STATE_H
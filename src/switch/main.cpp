@@ -57,17 +57,17 @@ void outputAudio()
     {
         // Load audio samples from the core when a buffer is empty
         audoutWaitPlayFinish(&audioReleasedBuffer, &count, UINT64_MAX);
-        AI::fillBuffer((uint32_t*)audioReleasedBuffer->buffer);
+        AI::fillBuffer((uint32_t*)audioReleasedBuffer->buffer, audioReleasedBuffer->data_size / sizeof(uint32_t));
         audoutAppendAudioOutBuffer(audioReleasedBuffer);
     }
 }
 
-bool startCore(bool reset)
+bool startCore(bool reset, bool resume = false)
 {
     if (!audioThread)
     {
         // Try to boot a ROM at the current path, but display an error if failed
-        if (reset && !Core::bootRom(path))
+        if (reset && !Core::bootRom(path, resume))
         {
             std::vector<std::string> message = { "Make sure the ROM file is accessible and try again." };
             SwitchUI::message("Error Loading ROM", message);
@@ -86,8 +86,8 @@ void stopCore()
 {
     if (audioThread)
     {
-        // Stop the emulator core
-        Core::stop();
+        // Park the emulator core; its threads persist until shutdown
+        Core::pause();
         audioThread->join();
         delete audioThread;
         audioThread = nullptr;
@@ -97,6 +97,7 @@ void stopCore()
 void settingsMenu()
 {
     const std::vector<std::string> toggle = { "Off", "On" };
+    const std::vector<std::string> frameskip = { "Off", "Auto", "Fixed" };
     size_t index = 0;
 
     while (true)
@@ -107,7 +108,11 @@ void settingsMenu()
             ListItem("FPS Limiter", toggle[Settings::fpsLimiter]),
             ListItem("Expansion Pak", toggle[Settings::expansionPak]),
             ListItem("Threaded RDP", toggle[Settings::threadedRdp]),
-            ListItem("Texture Filter", toggle[Settings::texFilter])
+            ListItem("Texture Filter", toggle[Settings::texFilter]),
+            ListItem("Dynamic Rate Control", toggle[Settings::dynamicRate]),
+            ListItem("DMA Timing", toggle[Settings::dmaTiming]),
+            ListItem("Instant Resume", toggle[Settings::instantResume]),
+            ListItem("Frameskip", frameskip[Settings::frameskip])
         };
 
         // Create the settings menu
@@ -124,6 +129,10 @@ void settingsMenu()
                 case 1: Settings::expansionPak = !Settings::expansionPak; break;
                 case 2: Settings::threadedRdp = !Settings::threadedRdp; break;
                 case 3: Settings::texFilter = !Settings::texFilter; break;
+                case 4: Settings::dynamicRate = !Settings::dynamicRate; break;
+                case 5: Settings::dmaTiming = !Settings::dmaTiming; break;
+                case 6: Settings::instantResume = !Settings::instantResume; break;
+                case 7: Settings::frameskip = (Settings::frameskip + 1) % 3; break;
             }
         }
         else
@@ -178,8 +187,8 @@ void fileBrowser()
 
                 if (files[menu.index].icon == file)
                 {
-                    // Close the browser If a ROM is loaded successfully
-                    if (startCore(true))
+                    // Close the browser If a ROM is loaded successfully, resuming it if possible
+                    if (startCore(true, true))
                         break;
 
                     // Remove the ROM from the path and continue browsing
@@ -411,8 +420,9 @@ int main()
             pauseMenu();
     }
 
-    // Ensure the core is stopped
+    // Ensure the core is stopped and its threads have exited
     stopCore();
+    Core::shutdown();
 
     // Disable the CPU overclock
     clkrstSetClockRate(&cpuSession, 1020000000);
@@ -0,0 +1,145 @@
+/*
+    Copyright 2022-2024 Hydr8gon
+
+    This file is part of rokuyon.
+
+    rokuyon is free software: you can redistribute it and/or modify it
+    under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    rokuyon is distributed in the hope that it will be useful, but
+    WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with rokuyon. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+#include "trace.h"
+#include "core.h"
+#include "log.h"
+#include "settings.h"
+
+#define RING_SIZE 0x20000 // Spans kept per thread, about 3MB each
+
+struct Span
+{
+    const char *name;
+    uint64_t start;
+    uint64_t duration;
+    int64_t arg;
+};
+
+struct Ring
+{
+    Span spans[RING_SIZE];
+    std::atomic<uint32_t> head;
+    const char *name;
+    int id;
+};
+
+namespace Trace
+{
+    // Each thread records into its own ring, so spans can be added without locking
+    std::vector<Ring*> rings;
+    std::mutex mutex;
+    thread_local Ring *ring;
+    thread_local const char *threadName;
+
+    Ring *getRing();
+}
+
+void Trace::setThreadName(const char *name)
+{
+    // Set the name shown for the current thread, applying it to the ring if it already exists
+    threadName = name;
+    if (ring) ring->name = name;
+}
+
+Ring *Trace::getRing()
+{
+    // Allocate a ring the first time a thread records a span, and keep it for reuse
+    if (!ring)
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        ring = new Ring();
+        ring->head.store(0);
+        ring->name = threadName ? threadName : "Thread";
+        ring->id = rings.size() + 1;
+        rings.push_back(ring);
+    }
+    return ring;
+}
+
+uint64_t Trace::begin()
+{
+    // Get the start time of a span, or 0 if tracing is disabled
+    return Settings::trace ? Core::hostTime() : 0;
+}
+
+void Trace::end(const char *name, uint64_t start, int64_t arg)
+{
+    // Record a span that was started while tracing was enabled, overwriting the oldest if the ring is full
+    if (!start) return;
+    Ring *ring = getRing();
+    uint32_t head = ring->head.load(std::memory_order_relaxed);
+    Span &span = ring->spans[head % RING_SIZE];
+    span.name = name;
+    span.start = start;
+    span.duration = Core::hostTime() - start;
+    span.arg = arg;
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+bool Trace::dump(const std::string &path)
+{
+    // Check if anything was recorded since the last dump
+    std::lock_guard<std::mutex> guard(mutex);
+    bool empty = true;
+    for (size_t i = 0; i < rings.size(); i++)
+        empty &= (rings[i]->head.load(std::memory_order_acquire) == 0);
+    if (empty) return false;
+
+    FILE *file = fopen(path.c_str(), "w");
+    if (!file) return false;
+
+    // Write spans in the Chrome trace event format, with microsecond timestamps
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    for (size_t i = 0; i < rings.size(); i++)
+    {
+        // Name the thread, then write its spans from oldest to newest
+        Ring *ring = rings[i];
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            first ? "" : ",\n", ring->id, ring->name);
+        first = false;
+
+        uint32_t head = ring->head.load(std::memory_order_acquire);
+        uint32_t count = std::min<uint32_t>(head, RING_SIZE);
+        for (uint32_t j = head - count; j != head; j++)
+        {
+            Span &span = ring->spans[j % RING_SIZE];
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                span.name, ring->id, span.start / 1000.0, span.duration / 1000.0);
+            if (span.arg >= 0)
+                fprintf(file, ",\"args\":{\"value\":%lld}", (long long)span.arg);
+            fprintf(file, "}");
+        }
+
+        // Start fresh for the next dump
+        ring->head.store(0, std::memory_order_relaxed);
+    }
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    LOG_INFO("Wrote trace to %s\n", path.c_str());
+    return true;
+}
@@ -29,6 +29,9 @@
 #include "memory.h"
 #include "mi.h"
 #include "rdp.h"
+#include "settings.h"
+#include "state.h"
+#include "trace.h"
 
 namespace VI
 {
@@ -43,8 +46,8 @@ namespace VI
     uint32_t vVideo;
     uint32_t xScale;
     uint32_t yScale;
-
-    void drawFrame();
+    uint32_t displayed[3];
+    std::atomic<uint64_t> convertTime;
 }
 
 _Framebuffer *VI::getFramebuffer()
@@ -59,9 +62,37 @@ _Framebuffer *VI::getFramebuffer()
     framebuffers.pop();
     ready.store(!framebuffers.empty());
     mutex.unlock();
+
+    // Let the emulator thread continue if it was waiting for a frame to be presented
+    Core::framePresented();
     return fb;
 }
 
+uint32_t VI::queuedFrames()
+{
+    // Get the number of frames waiting to be presented
+    std::lock_guard<std::mutex> guard(mutex);
+    return framebuffers.size();
+}
+
+bool VI::isDisplayed(uint32_t address)
+{
+    // Check if an address is the start of one of the last few framebuffers the VI displayed
+    // Games can offset the origin a bit past the start of the buffer, so allow some leeway
+    for (int i = 0; i < 3; i++)
+    {
+        if (displayed[i] && ((displayed[i] - address) & 0xFFFFFF) < 0x1000)
+            return true;
+    }
+    return false;
+}
+
+void VI::getStats(CoreStats &stats)
+{
+    // Get the total time spent converting frames for display
+    stats.viTime = convertTime.load(std::memory_order_relaxed);
+}
+
 void VI::reset()
 {
     // Reset the VI to its initial state
@@ -72,9 +103,34 @@ void VI::reset()
     vVideo = 0;
     xScale = 0;
     yScale = 0;
+    memset(displayed, 0, sizeof(displayed));
 
     // Schedule the first frame to be drawn
-    Core::schedule(drawFrame, (93750000 / 60) * 2);
+    Core::schedule(VI_DRAW_FRAME, (93750000 / 60) * 2);
+}
+
+void VI::saveState(State &state)
+{
+    // Save the VI registers
+    state.write(control);
+    state.write(origin);
+    state.write(width);
+    state.write(hVideo);
+    state.write(vVideo);
+    state.write(xScale);
+    state.write(yScale);
+}
+
+void VI::loadState(State &state)
+{
+    // Load the VI registers
+    state.read(control);
+    state.read(origin);
+    state.read(width);
+    state.read(hVideo);
+    state.read(vVideo);
+    state.read(xScale);
+    state.read(yScale);
 }
 
 uint32_t VI::read(uint32_t address)
@@ -155,9 +211,21 @@ void VI::drawFrame()
     // Ensure the RDP thread has finished drawing
     RDP::finishThread();
 
+    // Remember recently displayed framebuffers, so frameskip knows which ones the RDP can skip
+    if (origin != displayed[0])
+    {
+        displayed[2] = displayed[1];
+        displayed[1] = displayed[0];
+        displayed[0] = origin;
+    }
+
     // Allow up to 2 framebuffers to be queued, to preserve frame pacing if emulation runs ahead
-    if (framebuffers.size() < 2)
+    // Frames that will never be displayed, or are skipped, can skip conversion entirely
+    if (!Core::skipVideo && !Core::skipFrame && framebuffers.size() < 2)
     {
+        uint64_t start = Settings::perfStats ? Core::hostTime() : 0;
+        uint64_t traceStart = Trace::begin();
+
         // Create a new framebuffer
         _Framebuffer *fb = new _Framebuffer();
         fb->width  = ((xScale ? xScale : 0x200) * hVideo) >> 10;
@@ -227,6 +295,11 @@ void VI::drawFrame()
         framebuffers.push(fb);
         ready.store(true);
         mutex.unlock();
+
+        // Track how long the conversion took
+        Trace::end("Convert Frame", traceStart);
+        if (Settings::perfStats)
+            convertTime.store(convertTime.load(std::memory_order_relaxed) + Core::hostTime() - start, std::memory_order_relaxed);
     }
 
     // Finish the frame and request a VI interrupt
@@ -234,6 +307,6 @@ void VI::drawFrame()
     MI::setInterrupt(3);
 
     // Schedule the next frame to be drawn
-    Core::schedule(drawFrame, (93750000 / 60) * 2);
+    Core::schedule(VI_DRAW_FRAME, (93750000 / 60) * 2);
     Core::countFrame();
 }
@@ -22,6 +22,9 @@
 
 #include <cstdint>
 
+struct CoreStats;
+struct State;
+
 struct _Framebuffer
 {
     ~_Framebuffer() { delete[] data; }
@@ -34,10 +37,17 @@ struct _Framebuffer
 namespace VI
 {
     _Framebuffer *getFramebuffer();
+    uint32_t queuedFrames();
+    bool isDisplayed(uint32_t address);
+    void getStats(CoreStats &stats);
 
     void reset();
+    void saveState(State &state);
+    void loadState(State &state);
     uint32_t read(uint32_t address);
     void write(uint32_t address, uint32_t value);
+
+    void drawFrame();
 }
 
 #endif // VI_H